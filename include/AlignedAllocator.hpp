@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+//Allocates memory aligned to a fixed boundary (cache line by default)
+inline void* alignedAlloc(size_t size, size_t alignment)
+{
+	if (size == 0) {
+		size = alignment;
+	}
+#ifdef _WIN32
+	void* ptr = _aligned_malloc(size, alignment);
+#else
+	void* ptr = nullptr;
+	if (posix_memalign(&ptr, alignment, size) != 0) {
+		ptr = nullptr;
+	}
+#endif
+	if (ptr == nullptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+inline void alignedFree(void* ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	std::free(ptr);
+#endif
+}
+
+//Standard allocator returning Alignment-aligned storage, usable with std::vector
+template <typename T, size_t Alignment = 64>
+class AlignedAllocator
+{
+public:
+	typedef T value_type;
+
+	template <typename U>
+	struct rebind {
+		typedef AlignedAllocator<U, Alignment> other;
+	};
+
+	AlignedAllocator() noexcept {}
+
+	template <typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+	T* allocate(size_t n)
+	{
+		return static_cast<T*>(alignedAlloc(n * sizeof(T), Alignment));
+	}
+
+	void deallocate(T* ptr, size_t)
+	{
+		alignedFree(ptr);
+	}
+};
+
+template <typename T, typename U, size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&)
+{
+	return true;
+}
+
+template <typename T, typename U, size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&)
+{
+	return false;
+}
+
+template <typename T, size_t Alignment = 64>
+using AlignedVector = std::vector<T, AlignedAllocator<T, Alignment>>;
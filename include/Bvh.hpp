@@ -0,0 +1,475 @@
+#pragma once
+
+#include "Geometry.hpp"
+#include "TaskPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+//Node of a binary BVH, 32 bytes. Inner nodes have count == 0 and their two children at
+//index and index + 1, leaves reference count triangles starting at index.
+struct BvhNode
+{
+	Aabb bounds;
+	uint32_t index = 0;
+	uint32_t count = 0;
+
+	bool isLeaf() const
+	{
+		return count > 0;
+	}
+};
+
+//Bounding volume hierarchy over a triangle mesh, built top-down with the binned surface area
+//heuristic (Wald, "On fast Construction of SAH-based Bounding Volume Hierarchies").
+//The triangles are copied in leaf order, so a leaf reads one contiguous range.
+class Bvh
+{
+public:
+	static const int BIN_COUNT = 16;
+	static const uint32_t MAX_LEAF_SIZE = 8;
+	//Deeper subtrees become leaves, which bounds the traversal stack
+	static const int MAX_DEPTH = 64;
+
+	//Relative costs of visiting a node and of intersecting one triangle
+	static constexpr float TRAVERSAL_COST = 1.0f;
+	static constexpr float INTERSECTION_COST = 1.0f;
+
+	//Builds on the calling thread, or with the binning, partitioning and subtrees of large nodes
+	//spread over the pool if one is given. Either way gives the same tree and triangle order, only
+	//the nodes of parallel subtrees may be numbered differently.
+	void build(const TriangleMesh& mesh, TaskPool* pool = nullptr)
+	{
+		const size_t triangleCount = mesh.getTriangleCount();
+		if (triangleCount == 0) {
+			throw std::runtime_error("Cannot build a BVH without triangles");
+		}
+		if (triangleCount > std::numeric_limits<uint32_t>::max() / 2) {
+			throw std::runtime_error("Too many triangles for a BVH");
+		}
+
+		BuildState state;
+		state.pool = pool;
+		state.primitiveBounds.resize(triangleCount);
+		state.centroids.resize(triangleCount);
+		state.primitiveIndices.resize(triangleCount);
+		state.scratch.resize(triangleCount);
+
+		//Bounds of every triangle, and of the whole mesh as the union of per-chunk bounds
+		const size_t chunkCount = getChunkCount(state, static_cast<uint32_t>(triangleCount));
+		std::vector<Aabb> chunkBounds(chunkCount);
+		std::vector<Aabb> chunkCentroidBounds(chunkCount);
+		forEachChunk(state, 0, static_cast<uint32_t>(triangleCount), chunkCount, [&](size_t chunk, uint32_t chunkBegin, uint32_t chunkEnd) {
+			for (uint32_t i = chunkBegin; i < chunkEnd; i++) {
+				state.primitiveBounds[i] = mesh.getTriangleBounds(i);
+				state.centroids[i] = state.primitiveBounds[i].getCenter();
+				state.primitiveIndices[i] = i;
+				chunkBounds[chunk].extend(state.primitiveBounds[i]);
+				chunkCentroidBounds[chunk].extend(state.centroids[i]);
+			}
+		});
+		Aabb bounds;
+		Aabb centroidBounds;
+		for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+			bounds.extend(chunkBounds[chunk]);
+			centroidBounds.extend(chunkCentroidBounds[chunk]);
+		}
+
+		//A binary tree over n leaves has at most 2n - 1 nodes
+		nodes.resize(2 * triangleCount - 1);
+		state.nodeCount = 1;
+		nodes[0].bounds = bounds;
+		buildNode(state, 0, 0, static_cast<uint32_t>(triangleCount), centroidBounds, 0);
+		nodes.resize(state.nodeCount);
+
+		triangles.resize(triangleCount);
+		forEachChunk(state, 0, static_cast<uint32_t>(triangleCount), chunkCount, [&](size_t, uint32_t chunkBegin, uint32_t chunkEnd) {
+			for (uint32_t i = chunkBegin; i < chunkEnd; i++) {
+				const uint32_t triangle = state.primitiveIndices[i];
+				triangles[i] = PrecomputedTriangle(mesh.getVertex(triangle, 0), mesh.getVertex(triangle, 1), mesh.getVertex(triangle, 2), triangle);
+			}
+		});
+	}
+
+	//Finds the closest hit within [ray.tMin, ray.tMax], shortening ray.tMax to it
+	bool intersect(Ray& ray, Hit& hit) const
+	{
+		return traverse<false>(ray, hit);
+	}
+
+	//True if anything is hit within [ray.tMin, ray.tMax], e.g. for shadow rays
+	bool occluded(const Ray& ray) const
+	{
+		Ray shortened = ray;
+		Hit hit;
+		return traverse<true>(shortened, hit);
+	}
+
+	const std::vector<BvhNode>& getNodes() const
+	{
+		return nodes;
+	}
+
+	const std::vector<PrecomputedTriangle>& getTriangles() const
+	{
+		return triangles;
+	}
+
+	Aabb getBounds() const
+	{
+		return nodes.empty() ? Aabb() : nodes[0].bounds;
+	}
+
+	size_t getNodeMemorySize() const
+	{
+		return nodes.size() * sizeof(BvhNode);
+	}
+
+private:
+	std::vector<BvhNode> nodes;
+	std::vector<PrecomputedTriangle> triangles;
+
+	//Nodes with at least this many triangles are binned and partitioned in parallel
+	static const uint32_t PARALLEL_NODE_SIZE = 1 << 15;
+	//Subtrees with at least this many triangles become tasks of their own
+	static const uint32_t SUBTREE_TASK_SIZE = 1 << 12;
+
+	//Only needed while building
+	struct BuildState {
+		TaskPool* pool = nullptr;
+		std::vector<Aabb> primitiveBounds;
+		std::vector<glm::vec3> centroids;
+		std::vector<uint32_t> primitiveIndices;
+		std::vector<uint32_t> scratch;
+		std::atomic<uint32_t> nodeCount{ 0 };
+	};
+
+	struct Bin {
+		Aabb bounds;
+		uint32_t count = 0;
+	};
+
+	struct Split {
+		int axis = -1;
+		int bin = 0;
+		float cost = std::numeric_limits<float>::infinity();
+		//Filled in from the bins of the chosen axis
+		Aabb bounds[2];
+		//Filled in while partitioning
+		Aabb centroidBounds[2];
+	};
+
+	//Number of pieces a range is cut into for the pool, 1 without a pool or for small ranges
+	static size_t getChunkCount(const BuildState& state, uint32_t count)
+	{
+		if (state.pool == nullptr || count < PARALLEL_NODE_SIZE) {
+			return 1;
+		}
+		return std::min<size_t>(static_cast<size_t>(state.pool->getThreadCount()) * 4, count / 1024);
+	}
+
+	static uint32_t getChunkBegin(uint32_t begin, uint32_t end, size_t chunk, size_t chunkCount)
+	{
+		return begin + static_cast<uint32_t>(uint64_t(end - begin) * chunk / chunkCount);
+	}
+
+	//Calls function(chunk, begin, end) for chunkCount consecutive pieces of [begin, end)
+	template <typename Function>
+	static void forEachChunk(BuildState& state, uint32_t begin, uint32_t end, size_t chunkCount, const Function& function)
+	{
+		const auto runChunk = [&](size_t chunk) {
+			function(chunk, getChunkBegin(begin, end, chunk, chunkCount), getChunkBegin(begin, end, chunk + 1, chunkCount));
+		};
+		if (chunkCount == 1) {
+			runChunk(0);
+		}
+		else {
+			state.pool->parallelFor(chunkCount, runChunk);
+		}
+	}
+
+	void buildNode(BuildState& state, uint32_t nodeIndex, uint32_t begin, uint32_t end, const Aabb& centroidBounds, int depth)
+	{
+		const uint32_t count = end - begin;
+		const size_t chunkCount = getChunkCount(state, count);
+		Split split = findSplit(state, begin, end, nodes[nodeIndex].bounds, centroidBounds, chunkCount);
+
+		const float leafCost = INTERSECTION_COST * count;
+		if (count == 1 || depth >= MAX_DEPTH - 1 || (count <= MAX_LEAF_SIZE && leafCost <= split.cost)) {
+			nodes[nodeIndex].index = begin;
+			nodes[nodeIndex].count = count;
+			return;
+		}
+
+		uint32_t middle;
+		if (split.axis >= 0) {
+			middle = partition(state, begin, end, split, centroidBounds, chunkCount);
+		}
+		else {
+			//All centroids coincide, any split is as good as another
+			middle = begin + count / 2;
+			const uint32_t ranges[3] = { begin, middle, end };
+			for (int child = 0; child < 2; child++) {
+				for (uint32_t i = ranges[child]; i < ranges[child + 1]; i++) {
+					split.bounds[child].extend(state.primitiveBounds[state.primitiveIndices[i]]);
+					split.centroidBounds[child].extend(state.centroids[state.primitiveIndices[i]]);
+				}
+			}
+		}
+
+		const uint32_t left = state.nodeCount.fetch_add(2);
+		nodes[nodeIndex].index = left;
+		nodes[nodeIndex].count = 0;
+		nodes[left].bounds = split.bounds[0];
+		nodes[left + 1].bounds = split.bounds[1];
+
+		if (state.pool != nullptr && middle - begin >= SUBTREE_TASK_SIZE && end - middle >= SUBTREE_TASK_SIZE) {
+			TaskGroup group(*state.pool);
+			const Aabb leftCentroidBounds = split.centroidBounds[0];
+			group.spawn([this, &state, left, begin, middle, leftCentroidBounds, depth]() {
+				buildNode(state, left, begin, middle, leftCentroidBounds, depth + 1);
+			});
+			buildNode(state, left + 1, middle, end, split.centroidBounds[1], depth + 1);
+			group.wait();
+		}
+		else {
+			buildNode(state, left, begin, middle, split.centroidBounds[0], depth + 1);
+			buildNode(state, left + 1, middle, end, split.centroidBounds[1], depth + 1);
+		}
+	}
+
+	static int getBin(float centroid, float offset, float scale)
+	{
+		return std::min(BIN_COUNT - 1, std::max(0, static_cast<int>((centroid - offset) * scale)));
+	}
+
+	static float getBinScale(const Aabb& centroidBounds, int axis)
+	{
+		return BIN_COUNT * (1.0f - 1e-5f) / centroidBounds.getExtent()[axis];
+	}
+
+	//Adds the triangles of [begin, end) to the bins of one axis
+	static void binTriangles(const BuildState& state, uint32_t begin, uint32_t end, const Aabb& centroidBounds, int axis, Bin bins[BIN_COUNT])
+	{
+		const float scale = getBinScale(centroidBounds, axis);
+		const float offset = centroidBounds.min[axis];
+		for (uint32_t i = begin; i < end; i++) {
+			const uint32_t primitive = state.primitiveIndices[i];
+			Bin& bin = bins[getBin(state.centroids[primitive][axis], offset, scale)];
+			bin.bounds.extend(state.primitiveBounds[primitive]);
+			bin.count++;
+		}
+	}
+
+	//Best split between bins over all three axes, by the SAH cost relative to the node
+	Split findSplit(BuildState& state, uint32_t begin, uint32_t end, const Aabb& bounds, const Aabb& centroidBounds, size_t chunkCount) const
+	{
+		Split best;
+		const float nodeArea = bounds.getSurfaceArea();
+		if (chunkCount == 1) {
+			for (int axis = 0; axis < 3; axis++) {
+				if (centroidBounds.getExtent()[axis] > 0.0f) {
+					Bin bins[BIN_COUNT];
+					binTriangles(state, begin, end, centroidBounds, axis, bins);
+					evaluateBins(bins, axis, nodeArea, best);
+				}
+			}
+			return best;
+		}
+
+		//Every chunk bins its triangles on all three axes, the chunks are merged afterwards
+		std::vector<Bin> chunkBins(chunkCount * 3 * BIN_COUNT);
+		forEachChunk(state, begin, end, chunkCount, [&](size_t chunk, uint32_t chunkBegin, uint32_t chunkEnd) {
+			for (int axis = 0; axis < 3; axis++) {
+				if (centroidBounds.getExtent()[axis] > 0.0f) {
+					binTriangles(state, chunkBegin, chunkEnd, centroidBounds, axis, &chunkBins[(chunk * 3 + axis) * BIN_COUNT]);
+				}
+			}
+		});
+
+		for (int axis = 0; axis < 3; axis++) {
+			if (!(centroidBounds.getExtent()[axis] > 0.0f)) {
+				continue;
+			}
+			Bin bins[BIN_COUNT];
+			for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+				for (int i = 0; i < BIN_COUNT; i++) {
+					const Bin& chunkBin = chunkBins[(chunk * 3 + axis) * BIN_COUNT + i];
+					bins[i].bounds.extend(chunkBin.bounds);
+					bins[i].count += chunkBin.count;
+				}
+			}
+			evaluateBins(bins, axis, nodeArea, best);
+		}
+		return best;
+	}
+
+	//Sweeps the bins from both sides to get the cost of every split plane
+	static void evaluateBins(const Bin bins[BIN_COUNT], int axis, float nodeArea, Split& best)
+	{
+		Aabb rightBounds[BIN_COUNT];
+		uint32_t rightCounts[BIN_COUNT];
+		Aabb bounds;
+		uint32_t count = 0;
+		for (int i = BIN_COUNT - 1; i > 0; i--) {
+			bounds.extend(bins[i].bounds);
+			count += bins[i].count;
+			rightBounds[i] = bounds;
+			rightCounts[i] = count;
+		}
+
+		Aabb leftBounds;
+		uint32_t leftCount = 0;
+		for (int i = 1; i < BIN_COUNT; i++) {
+			leftBounds.extend(bins[i - 1].bounds);
+			leftCount += bins[i - 1].count;
+			if (leftCount == 0 || rightCounts[i] == 0) {
+				continue;
+			}
+			const float cost = TRAVERSAL_COST + INTERSECTION_COST *
+				(leftBounds.getSurfaceArea() * leftCount + rightBounds[i].getSurfaceArea() * rightCounts[i]) / nodeArea;
+			if (cost < best.cost) {
+				best.axis = axis;
+				best.bin = i;
+				best.cost = cost;
+				best.bounds[0] = leftBounds;
+				best.bounds[1] = rightBounds[i];
+			}
+		}
+	}
+
+	//Moves the triangles left of the split plane to the front of the range, returns where the right side starts,
+	//and collects the centroid bounds of both sides in split. Both sides keep their order, so the serial and the
+	//parallel build produce the same tree. In parallel every chunk counts its sides, then scatters into the scratch
+	//array at offsets from a prefix sum.
+	uint32_t partition(BuildState& state, uint32_t begin, uint32_t end, Split& split, const Aabb& centroidBounds, size_t chunkCount) const
+	{
+		const int axis = split.axis;
+		const float scale = getBinScale(centroidBounds, axis);
+		const float offset = centroidBounds.min[axis];
+		const int splitBin = split.bin;
+		const auto isLeft = [&state, axis, offset, scale, splitBin](uint32_t primitive) {
+			return getBin(state.centroids[primitive][axis], offset, scale) < splitBin;
+		};
+
+		if (chunkCount == 1) {
+			//Left triangles are compacted in place, right ones parked in the scratch array
+			uint32_t leftPosition = begin;
+			uint32_t rightPosition = begin;
+			for (uint32_t i = begin; i < end; i++) {
+				const uint32_t primitive = state.primitiveIndices[i];
+				if (isLeft(primitive)) {
+					state.primitiveIndices[leftPosition++] = primitive;
+					split.centroidBounds[0].extend(state.centroids[primitive]);
+				}
+				else {
+					state.scratch[rightPosition++] = primitive;
+					split.centroidBounds[1].extend(state.centroids[primitive]);
+				}
+			}
+			std::copy(state.scratch.begin() + begin, state.scratch.begin() + rightPosition, state.primitiveIndices.begin() + leftPosition);
+			return leftPosition;
+		}
+
+		std::vector<uint32_t> leftCounts(chunkCount, 0);
+		forEachChunk(state, begin, end, chunkCount, [&](size_t chunk, uint32_t chunkBegin, uint32_t chunkEnd) {
+			for (uint32_t i = chunkBegin; i < chunkEnd; i++) {
+				leftCounts[chunk] += isLeft(state.primitiveIndices[i]) ? 1 : 0;
+			}
+		});
+
+		//Where each chunk writes its first left and first right triangle
+		std::vector<uint32_t> leftOffsets(chunkCount);
+		std::vector<uint32_t> rightOffsets(chunkCount);
+		uint32_t leftTotal = 0;
+		for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+			leftOffsets[chunk] = leftTotal;
+			rightOffsets[chunk] = getChunkBegin(begin, end, chunk, chunkCount) - begin - leftTotal;
+			leftTotal += leftCounts[chunk];
+		}
+		const uint32_t middle = begin + leftTotal;
+
+		std::vector<Aabb> chunkCentroidBounds(chunkCount * 2);
+		forEachChunk(state, begin, end, chunkCount, [&](size_t chunk, uint32_t chunkBegin, uint32_t chunkEnd) {
+			uint32_t leftPosition = begin + leftOffsets[chunk];
+			uint32_t rightPosition = middle + rightOffsets[chunk];
+			for (uint32_t i = chunkBegin; i < chunkEnd; i++) {
+				const uint32_t primitive = state.primitiveIndices[i];
+				const bool left = isLeft(primitive);
+				state.scratch[left ? leftPosition++ : rightPosition++] = primitive;
+				chunkCentroidBounds[chunk * 2 + (left ? 0 : 1)].extend(state.centroids[primitive]);
+			}
+		});
+		for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+			split.centroidBounds[0].extend(chunkCentroidBounds[chunk * 2]);
+			split.centroidBounds[1].extend(chunkCentroidBounds[chunk * 2 + 1]);
+		}
+		forEachChunk(state, begin, end, chunkCount, [&](size_t, uint32_t chunkBegin, uint32_t chunkEnd) {
+			std::copy(state.scratch.begin() + chunkBegin, state.scratch.begin() + chunkEnd, state.primitiveIndices.begin() + chunkBegin);
+		});
+		return middle;
+	}
+
+	template <bool AnyHit>
+	bool traverse(Ray& ray, Hit& hit) const
+	{
+		if (nodes.empty()) {
+			return false;
+		}
+		const RayBoxTest boxTest(ray);
+		if (boxTest.intersect(nodes[0].bounds, ray.tMin, ray.tMax) == std::numeric_limits<float>::infinity()) {
+			return false;
+		}
+
+		//Nodes still to visit with the distance the ray enters them
+		uint32_t stack[MAX_DEPTH];
+		float stackEntries[MAX_DEPTH];
+		int stackSize = 0;
+		uint32_t current = 0;
+		bool found = false;
+		while (true) {
+			const BvhNode& node = nodes[current];
+			if (node.isLeaf()) {
+				for (uint32_t i = node.index; i < node.index + node.count; i++) {
+					if (intersectTriangle(ray, triangles[i], hit)) {
+						found = true;
+						if (AnyHit) {
+							return true;
+						}
+					}
+				}
+			}
+			else {
+				//Visit the nearer child first, the farther one is skipped later if a hit in front of it was found
+				const float entry0 = boxTest.intersect(nodes[node.index].bounds, ray.tMin, ray.tMax);
+				const float entry1 = boxTest.intersect(nodes[node.index + 1].bounds, ray.tMin, ray.tMax);
+				const bool hit0 = entry0 != std::numeric_limits<float>::infinity();
+				const bool hit1 = entry1 != std::numeric_limits<float>::infinity();
+				if (hit0 && hit1) {
+					const bool swap = entry1 < entry0;
+					stack[stackSize] = node.index + (swap ? 0 : 1);
+					stackEntries[stackSize++] = swap ? entry0 : entry1;
+					current = node.index + (swap ? 1 : 0);
+					continue;
+				}
+				if (hit0 || hit1) {
+					current = node.index + (hit0 ? 0 : 1);
+					continue;
+				}
+			}
+
+			do {
+				if (stackSize == 0) {
+					return found;
+				}
+				stackSize--;
+			} while (stackEntries[stackSize] > ray.tMax);
+			current = stack[stackSize];
+		}
+	}
+};
@@ -0,0 +1,267 @@
+#pragma once
+
+#include "AlignedAllocator.hpp"
+#include "Geometry.hpp"
+#include "WideBvh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+//Node of an 8-wide BVH with quantized child bounds, 128 bytes. Every plane of a child box is stored
+//as one byte q and decodes to origin[axis] + q * 2^exponents[axis], a grid spanning the bounds of
+//the node. The box test only touches the first cache line, the second holds the child references
+//in the same form as in a WideBvhNode.
+struct alignas(64) CompressedWideBvhNode
+{
+	static const int WIDTH = 8;
+
+	float origin[3];
+	int8_t exponents[3];
+	//Bit per used child slot
+	uint8_t childMask;
+	//minX, minY, minZ, maxX, maxY, maxZ
+	uint8_t quantized[6][WIDTH];
+	uint32_t children[WIDTH];
+	uint32_t counts[WIDTH];
+
+	CompressedWideBvhNode()
+	{
+		std::memset(this, 0, sizeof(CompressedWideBvhNode));
+	}
+
+	//2^exponents[axis], assembled from its bits
+	float getScale(int axis) const
+	{
+		const uint32_t bits = static_cast<uint32_t>(exponents[axis] + 127) << 23;
+		float scale;
+		std::memcpy(&scale, &bits, sizeof(scale));
+		return scale;
+	}
+
+	float decode(int plane, int lane) const
+	{
+		const int axis = plane % 3;
+		return origin[axis] + static_cast<float>(quantized[plane][lane]) * getScale(axis);
+	}
+};
+
+static_assert(sizeof(CompressedWideBvhNode) == 128, "CompressedWideBvhNode should fill exactly two cache lines");
+
+//Slab test of one ray against the decoded child boxes of a CompressedWideBvhNode
+struct CompressedWideRayBoxTest
+{
+	WideRayBoxTest wide;
+
+	explicit CompressedWideRayBoxTest(const Ray& ray) : wide(ray)
+	{
+	}
+
+	//Same contract as WideRayBoxTest::intersect. The planes are decoded with the arithmetic the
+	//build checked them with, so the boxes tested always contain the original ones.
+	int intersect(const CompressedWideBvhNode& node, float tMin, float tMax, float* entries) const
+	{
+#if defined(RAYTRACING_OPENGLVIEWER_AVX2)
+		__m256 entry = _mm256_set1_ps(tMin);
+		__m256 exit = _mm256_set1_ps(tMax);
+		for (int axis = 0; axis < 3; axis++) {
+			const __m256 origin = _mm256_set1_ps(node.origin[axis]);
+			const __m256 scale = _mm256_set1_ps(node.getScale(axis));
+			const __m256 nearPlane = _mm256_add_ps(origin, _mm256_mul_ps(decodePlane(node, wide.nearPlane[axis]), scale));
+			const __m256 farPlane = _mm256_add_ps(origin, _mm256_mul_ps(decodePlane(node, wide.farPlane[axis]), scale));
+			entry = _mm256_max_ps(entry, _mm256_add_ps(_mm256_mul_ps(nearPlane, wide.inverseDirection[axis]), wide.scaledOrigin[axis]));
+			exit = _mm256_min_ps(exit, _mm256_add_ps(_mm256_mul_ps(farPlane, wide.inverseDirection[axis]), wide.scaledOrigin[axis]));
+		}
+		_mm256_storeu_ps(entries, entry);
+		return _mm256_movemask_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ)) & node.childMask;
+#elif defined(RAYTRACING_OPENGLVIEWER_SSE2)
+		int mask = 0;
+		for (int half = 0; half < CompressedWideBvhNode::WIDTH; half += 4) {
+			__m128 entry = _mm_set1_ps(tMin);
+			__m128 exit = _mm_set1_ps(tMax);
+			for (int axis = 0; axis < 3; axis++) {
+				const __m128 origin = _mm_set1_ps(node.origin[axis]);
+				const __m128 scale = _mm_set1_ps(node.getScale(axis));
+				const __m128 nearPlane = _mm_add_ps(origin, _mm_mul_ps(decodePlane(node, wide.nearPlane[axis], half), scale));
+				const __m128 farPlane = _mm_add_ps(origin, _mm_mul_ps(decodePlane(node, wide.farPlane[axis], half), scale));
+				entry = _mm_max_ps(entry, _mm_add_ps(_mm_mul_ps(nearPlane, wide.inverseDirection[axis]), wide.scaledOrigin[axis]));
+				exit = _mm_min_ps(exit, _mm_add_ps(_mm_mul_ps(farPlane, wide.inverseDirection[axis]), wide.scaledOrigin[axis]));
+			}
+			_mm_storeu_ps(entries + half, entry);
+			mask |= _mm_movemask_ps(_mm_cmple_ps(entry, exit)) << half;
+		}
+		return mask & node.childMask;
+#else
+		int mask = 0;
+		for (int lane = 0; lane < CompressedWideBvhNode::WIDTH; lane++) {
+			float entry = tMin;
+			float exit = tMax;
+			for (int axis = 0; axis < 3; axis++) {
+				entry = std::max(entry, node.decode(wide.nearPlane[axis], lane) * wide.scalar.inverseDirection[axis] + wide.scalar.scaledOrigin[axis]);
+				exit = std::min(exit, node.decode(wide.farPlane[axis], lane) * wide.scalar.inverseDirection[axis] + wide.scalar.scaledOrigin[axis]);
+			}
+			entries[lane] = entry;
+			mask |= (entry <= exit ? 1 : 0) << lane;
+		}
+		return mask & node.childMask;
+#endif
+	}
+
+private:
+#if defined(RAYTRACING_OPENGLVIEWER_AVX2)
+	static __m256 decodePlane(const CompressedWideBvhNode& node, int plane)
+	{
+		const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(node.quantized[plane]));
+		return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+	}
+#elif defined(RAYTRACING_OPENGLVIEWER_SSE2)
+	static __m128 decodePlane(const CompressedWideBvhNode& node, int plane, int half)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(node.quantized[plane]));
+		const __m128i words = _mm_unpacklo_epi8(bytes, zero);
+		return _mm_cvtepi32_ps(half == 0 ? _mm_unpacklo_epi16(words, zero) : _mm_unpackhi_epi16(words, zero));
+	}
+#endif
+};
+
+//WideBvh with CompressedWideBvhNodes, half the node memory of the uncompressed layout. The quantized
+//boxes are rounded outwards, so they are slightly larger and a ray visits a few more nodes, but it
+//never misses anything the WideBvh would hit.
+class CompressedWideBvh
+{
+public:
+	static const int WIDTH = CompressedWideBvhNode::WIDTH;
+	static const int QUANTIZED_MAX = 255;
+
+	//Copies the triangles of wideBvh, which can be discarded afterwards
+	void build(const WideBvh& wideBvh)
+	{
+		const std::vector<WideBvhNode, AlignedAllocator<WideBvhNode>>& wideNodes = wideBvh.getNodes();
+		if (wideNodes.empty()) {
+			throw std::runtime_error("Cannot compress an empty BVH");
+		}
+
+		nodes.resize(wideNodes.size());
+		for (size_t i = 0; i < wideNodes.size(); i++) {
+			nodes[i] = compress(wideNodes[i]);
+		}
+		bounds = wideBvh.getBounds();
+		triangles = wideBvh.getTriangles();
+	}
+
+	//Finds the closest hit within [ray.tMin, ray.tMax], shortening ray.tMax to it
+	bool intersect(Ray& ray, Hit& hit) const
+	{
+		return traverse<false>(ray, hit);
+	}
+
+	//True if anything is hit within [ray.tMin, ray.tMax], e.g. for shadow rays
+	bool occluded(const Ray& ray) const
+	{
+		Ray shortened = ray;
+		Hit hit;
+		return traverse<true>(shortened, hit);
+	}
+
+	const std::vector<CompressedWideBvhNode, AlignedAllocator<CompressedWideBvhNode>>& getNodes() const
+	{
+		return nodes;
+	}
+
+	Aabb getBounds() const
+	{
+		return bounds;
+	}
+
+	size_t getNodeMemorySize() const
+	{
+		return nodes.size() * sizeof(CompressedWideBvhNode);
+	}
+
+private:
+	static_assert(CompressedWideBvhNode::WIDTH == WideBvh::WIDTH, "The compressed nodes are traversed like WideBvh nodes");
+
+	std::vector<CompressedWideBvhNode, AlignedAllocator<CompressedWideBvhNode>> nodes;
+	std::vector<PrecomputedTriangle> triangles;
+	Aabb bounds;
+
+	static float getScale(int exponent)
+	{
+		return std::ldexp(1.0f, exponent);
+	}
+
+	static CompressedWideBvhNode compress(const WideBvhNode& wideNode)
+	{
+		CompressedWideBvhNode node;
+		Aabb parent;
+		for (int lane = 0; lane < WIDTH; lane++) {
+			if (wideNode.bounds[0][lane] <= wideNode.bounds[3][lane]) {
+				node.childMask |= 1 << lane;
+				node.children[lane] = wideNode.children[lane];
+				node.counts[lane] = wideNode.counts[lane];
+				parent.extend(glm::vec3(wideNode.bounds[0][lane], wideNode.bounds[1][lane], wideNode.bounds[2][lane]));
+				parent.extend(glm::vec3(wideNode.bounds[3][lane], wideNode.bounds[4][lane], wideNode.bounds[5][lane]));
+			}
+		}
+
+		for (int axis = 0; axis < 3; axis++) {
+			//Smallest power of two step whose grid reaches the far side of the node
+			const float origin = parent.min[axis];
+			int exponent = 0;
+			std::frexp((parent.max[axis] - origin) / QUANTIZED_MAX, &exponent);
+			exponent = std::max(exponent, -126);
+			while (origin + QUANTIZED_MAX * getScale(exponent) < parent.max[axis]) {
+				exponent++;
+			}
+			if (exponent > 127) {
+				throw std::runtime_error("BVH node too large to quantize");
+			}
+			node.origin[axis] = origin;
+			node.exponents[axis] = static_cast<int8_t>(exponent);
+
+			//Round down the minimum and up the maximum, then correct for the rounding of the decode itself.
+			//std::min takes references, the copy keeps QUANTIZED_MAX from needing a definition outside the class.
+			const float scale = getScale(exponent);
+			const int quantizedMax = QUANTIZED_MAX;
+			for (int lane = 0; lane < WIDTH; lane++) {
+				if (!(node.childMask & (1 << lane))) {
+					continue;
+				}
+				const float minimum = wideNode.bounds[axis][lane];
+				const float maximum = wideNode.bounds[axis + 3][lane];
+				int low = static_cast<int>(std::floor((minimum - origin) / scale));
+				int high = static_cast<int>(std::ceil((maximum - origin) / scale));
+				low = std::min(std::max(low, 0), quantizedMax);
+				high = std::min(std::max(high, 0), quantizedMax);
+				while (low > 0 && origin + low * scale > minimum) {
+					low--;
+				}
+				while (high < QUANTIZED_MAX && origin + high * scale < maximum) {
+					high++;
+				}
+				node.quantized[axis][lane] = static_cast<uint8_t>(low);
+				node.quantized[axis + 3][lane] = static_cast<uint8_t>(high);
+			}
+		}
+		return node;
+	}
+
+	template <bool AnyHit>
+	bool traverse(Ray& ray, Hit& hit) const
+	{
+		if (nodes.empty()) {
+			return false;
+		}
+		const CompressedWideRayBoxTest boxTest(ray);
+		if (boxTest.wide.scalar.intersect(bounds, ray.tMin, ray.tMax) == std::numeric_limits<float>::infinity()) {
+			return false;
+		}
+		return WideBvh::traverseNodes<AnyHit>(nodes.data(), triangles.data(), boxTest, ray, hit);
+	}
+};
@@ -0,0 +1,258 @@
+#pragma once
+
+#include "AlignedAllocator.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+//Bump allocator for scratch memory that lives for one frame. Allocating is a pointer increment,
+//nothing is freed individually and reset() makes all of it available again. Blocks come from
+//anonymous mappings advised to use transparent huge pages where the OS supports it.
+//Not thread-safe, every thread uses its own arena (see FrameArenas).
+class FrameArena
+{
+public:
+	static const size_t CACHE_LINE = 64;
+	static const size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+
+	explicit FrameArena(size_t blockSize = HUGE_PAGE_SIZE) : blockSize(blockSize)
+	{
+	}
+
+	~FrameArena()
+	{
+		for (Block& block : blocks) {
+			freeBlock(block);
+		}
+	}
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	//Memory stays valid until the next reset(); alignment has to be a power of two
+	void* allocate(size_t size, size_t alignment = CACHE_LINE)
+	{
+		if (current < blocks.size()) {
+			Block& block = blocks[current];
+			const size_t offset = (block.used + alignment - 1) & ~(alignment - 1);
+			if (offset + size <= block.size) {
+				block.used = offset + size;
+				bytesAllocated += size;
+				return block.memory + offset;
+			}
+			//The rest of this block is wasted, later blocks are tried in order
+			current++;
+			return allocate(size, alignment);
+		}
+
+		blocks.push_back(allocateBlock(std::max(blockSize, size + alignment)));
+		current = blocks.size() - 1;
+		return allocate(size, alignment);
+	}
+
+	//Uninitialized storage for count objects, which are never destroyed
+	template <typename T>
+	T* allocateArray(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "Arena memory is released without running destructors");
+		//std::max takes references, a copy keeps CACHE_LINE from needing a definition outside the class
+		const size_t cacheLine = CACHE_LINE;
+		return static_cast<T*>(allocate(count * sizeof(T), std::max(alignof(T), cacheLine)));
+	}
+
+	//Releases everything allocated since the last reset. If the frame needed more than one block,
+	//they are replaced by one block large enough for all of it, so the next frame needs no new memory.
+	void reset()
+	{
+		if (blocks.size() > 1) {
+			size_t total = 0;
+			for (Block& block : blocks) {
+				total += block.size;
+				freeBlock(block);
+			}
+			blocks.clear();
+			blocks.push_back(allocateBlock(total));
+		}
+		for (Block& block : blocks) {
+			block.used = 0;
+		}
+		current = 0;
+		bytesAllocated = 0;
+	}
+
+	//Bytes handed out since the last reset, without alignment padding
+	size_t getBytesAllocated() const
+	{
+		return bytesAllocated;
+	}
+
+	size_t getCapacity() const
+	{
+		size_t capacity = 0;
+		for (const Block& block : blocks) {
+			capacity += block.size;
+		}
+		return capacity;
+	}
+
+private:
+	struct Block {
+		unsigned char* memory = nullptr;
+		size_t size = 0;
+		size_t used = 0;
+		//Start and size of the whole mapping, which is larger than the block to align it to a huge page
+		void* mapping = nullptr;
+		size_t mappingSize = 0;
+	};
+
+	std::vector<Block> blocks;
+	size_t current = 0;
+	size_t blockSize;
+	size_t bytesAllocated = 0;
+
+	static Block allocateBlock(size_t size)
+	{
+		Block block;
+		block.size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+#ifdef __linux__
+		//Huge pages need 2 MB aligned addresses, so map one page more than needed and align inside it
+		block.mappingSize = block.size + HUGE_PAGE_SIZE;
+		block.mapping = mmap(nullptr, block.mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (block.mapping == MAP_FAILED) {
+			throw std::bad_alloc();
+		}
+		const uintptr_t address = reinterpret_cast<uintptr_t>(block.mapping);
+		block.memory = reinterpret_cast<unsigned char*>((address + HUGE_PAGE_SIZE - 1) & ~(uintptr_t(HUGE_PAGE_SIZE) - 1));
+#ifdef MADV_HUGEPAGE
+		madvise(block.memory, block.size, MADV_HUGEPAGE);
+#endif
+#else
+		block.memory = static_cast<unsigned char*>(alignedAlloc(block.size, CACHE_LINE));
+#endif
+		return block;
+	}
+
+	static void freeBlock(Block& block)
+	{
+#ifdef __linux__
+		munmap(block.mapping, block.mappingSize);
+#else
+		alignedFree(block.memory);
+#endif
+		block = Block();
+	}
+};
+
+//One FrameArena per thread that asks for one, e.g. the render thread and the workers of a TileScheduler.
+//reset() must only be called while no thread is using its arena, i.e. between two frames.
+class FrameArenas
+{
+public:
+	FrameArenas() : id(nextId()++)
+	{
+	}
+
+	FrameArenas(const FrameArenas&) = delete;
+	FrameArenas& operator=(const FrameArenas&) = delete;
+
+	//Arena of the calling thread, created on its first call
+	FrameArena& local()
+	{
+		LocalCache& cache = getLocalCache();
+		if (cache.owner == id) {
+			return *cache.arena;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		const std::thread::id thread = std::this_thread::get_id();
+		FrameArena* arena = nullptr;
+		for (ThreadArena& threadArena : arenas) {
+			if (threadArena.thread == thread) {
+				arena = threadArena.arena.get();
+			}
+		}
+		if (arena == nullptr) {
+			arenas.push_back({ thread, std::unique_ptr<FrameArena>(new FrameArena) });
+			arena = arenas.back().arena.get();
+		}
+		cache.owner = id;
+		cache.arena = arena;
+		return *arena;
+	}
+
+	//Called at a frame boundary, remembers how much the finished frame allocated
+	void reset()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		size_t bytes = 0;
+		for (ThreadArena& threadArena : arenas) {
+			bytes += threadArena.arena->getBytesAllocated();
+			threadArena.arena->reset();
+		}
+		bytesLastFrame = bytes;
+		peakBytesPerFrame = std::max(peakBytesPerFrame.load(), bytes);
+	}
+
+	//Bytes allocated from all arenas during the last finished frame
+	size_t getBytesLastFrame() const
+	{
+		return bytesLastFrame;
+	}
+
+	size_t getPeakBytesPerFrame() const
+	{
+		return peakBytesPerFrame;
+	}
+
+	size_t getCapacity()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		size_t capacity = 0;
+		for (ThreadArena& threadArena : arenas) {
+			capacity += threadArena.arena->getCapacity();
+		}
+		return capacity;
+	}
+
+private:
+	struct ThreadArena {
+		std::thread::id thread;
+		std::unique_ptr<FrameArena> arena;
+	};
+
+	//Last arena the thread looked up, so the common case takes no lock
+	struct LocalCache {
+		uint64_t owner = 0;
+		FrameArena* arena = nullptr;
+	};
+
+	const uint64_t id;
+	std::mutex mutex;
+	std::vector<ThreadArena> arenas;
+	std::atomic<size_t> bytesLastFrame{ 0 };
+	std::atomic<size_t> peakBytesPerFrame{ 0 };
+
+	static std::atomic<uint64_t>& nextId()
+	{
+		static std::atomic<uint64_t> counter{ 1 };
+		return counter;
+	}
+
+	static LocalCache& getLocalCache()
+	{
+		static thread_local LocalCache cache;
+		return cache;
+	}
+};
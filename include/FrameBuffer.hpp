@@ -0,0 +1,95 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "AlignedAllocator.hpp"
+
+//Writable view of a frame lent to the renderer.
+//Rows are stride pixels apart; only the first width pixels of each row are displayed.
+//Row 0 is the top of the image, the viewer, the tile scheduler and the image writers all follow that order.
+struct FrameView
+{
+	glm::vec3* pixels = nullptr;
+	int width = 0;
+	int height = 0;
+	int stride = 0;
+
+	glm::vec3* row(int y) const
+	{
+		return pixels + static_cast<size_t>(y) * stride;
+	}
+
+	glm::vec3& at(int x, int y) const
+	{
+		return row(y)[x];
+	}
+};
+
+//Rectangle of an image in pixels, e.g. a finished bucket of a tile renderer
+struct ImageRegion
+{
+	int x = 0;
+	int y = 0;
+	int width = 0;
+	int height = 0;
+
+	ImageRegion() {}
+	ImageRegion(int x, int y, int width, int height) : x(x), y(y), width(width), height(height) {}
+};
+
+//Owns the pixels of a frame of any size. The storage is cache-line aligned and every row starts
+//on a cache-line boundary.
+class FrameBuffer
+{
+public:
+	//Number of pixels a row is padded to so that 12-byte pixels keep rows 64-byte aligned
+	static const int ROW_ALIGNMENT = 16;
+
+	//Keeps the pixels if the size does not change, otherwise the frame is cleared to black
+	void resize(int newWidth, int newHeight)
+	{
+		if (newWidth == width && newHeight == height) {
+			return;
+		}
+		width = newWidth;
+		height = newHeight;
+		stride = (newWidth + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT;
+		pixels.assign(static_cast<size_t>(stride) * height, glm::vec3(0.0f));
+	}
+
+	FrameView view()
+	{
+		FrameView frame;
+		frame.pixels = pixels.data();
+		frame.width = width;
+		frame.height = height;
+		frame.stride = stride;
+		return frame;
+	}
+
+	const glm::vec3* data() const
+	{
+		return pixels.data();
+	}
+
+	glm::vec3* data()
+	{
+		return pixels.data();
+	}
+
+	//Size in bytes of the rows covering the frame, including the padding
+	size_t sizeInBytes() const
+	{
+		return static_cast<size_t>(stride) * height * sizeof(glm::vec3);
+	}
+
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	int getStride() const { return stride; }
+
+private:
+	AlignedVector<glm::vec3> pixels;
+	int width = 0;
+	int height = 0;
+	int stride = 0;
+};
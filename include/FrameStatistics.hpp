@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include "TraceRecorder.hpp"
+
+//Stages a frame goes through from the renderer to the screen
+enum class FrameStage {
+	Render,		//renderFrame/createImage on the render thread
+	SetImage,	//copying or interleaving a whole image into the frame buffer
+	Accumulate,	//adding frames and tiles to the running sum or the tile image
+	Upload,		//conversion, pixel buffer copy and glTexSubImage2D
+	Draw,		//clear and glDrawArrays
+	Swap,		//glfwSwapBuffers
+	Wait,		//sleeping for events or for the next present time
+	Frame,		//everything the display loop does for one presented frame
+	GpuUpload,	//GPU time of the uploads, measured with timer queries
+	GpuDraw,	//GPU time of clearing and drawing the fullscreen triangle
+	Count
+};
+
+inline const char* getFrameStageName(FrameStage stage)
+{
+	static const char* names[] = { "render", "setImage", "accumulate", "upload", "draw", "swap", "wait", "frame", "gpuUpload", "gpuDraw" };
+	return names[static_cast<int>(stage)];
+}
+
+//Statistics over the most recent samples of a stage, in milliseconds
+struct StageStatistics
+{
+	size_t samples = 0;
+	double mean = 0.0;
+	double p50 = 0.0;
+	double p99 = 0.0;
+	double max = 0.0;
+};
+
+//Rolling per-stage timings. Every stage keeps its last WINDOW_SIZE samples behind its own lock,
+//so the render thread and the display loop only contend when they record the same stage.
+class FrameStatistics
+{
+public:
+	static const size_t WINDOW_SIZE = 1024;
+
+	void record(FrameStage stage, double milliseconds)
+	{
+		Stage& timings = stages[static_cast<int>(stage)];
+		std::lock_guard<std::mutex> lock(timings.mutex);
+		if (timings.samples.size() < WINDOW_SIZE) {
+			timings.samples.push_back(milliseconds);
+		}
+		else {
+			timings.samples[timings.next] = milliseconds;
+		}
+		timings.next = (timings.next + 1) % WINDOW_SIZE;
+	}
+
+	StageStatistics getStatistics(FrameStage stage)
+	{
+		Stage& timings = stages[static_cast<int>(stage)];
+		std::vector<double> sorted;
+		{
+			std::lock_guard<std::mutex> lock(timings.mutex);
+			sorted = timings.samples;
+		}
+
+		StageStatistics statistics;
+		if (sorted.empty()) {
+			return statistics;
+		}
+
+		std::sort(sorted.begin(), sorted.end());
+		statistics.samples = sorted.size();
+		double sum = 0.0;
+		for (double sample : sorted) {
+			sum += sample;
+		}
+		statistics.mean = sum / sorted.size();
+		statistics.p50 = sorted[getNearestRank(sorted.size(), 50)];
+		statistics.p99 = sorted[getNearestRank(sorted.size(), 99)];
+		statistics.max = sorted.back();
+		return statistics;
+	}
+
+	void reset()
+	{
+		for (Stage& timings : stages) {
+			std::lock_guard<std::mutex> lock(timings.mutex);
+			timings.samples.clear();
+			timings.next = 0;
+		}
+	}
+
+	//Human readable table of all stages that were recorded
+	void writeReport(std::ostream& out)
+	{
+		out << "stage          samples    mean ms     p50 ms     p99 ms     max ms\n";
+		for (int i = 0; i < static_cast<int>(FrameStage::Count); i++) {
+			const StageStatistics statistics = getStatistics(static_cast<FrameStage>(i));
+			if (statistics.samples == 0) {
+				continue;
+			}
+			out << std::left << std::setw(12) << getFrameStageName(static_cast<FrameStage>(i)) << std::right
+				<< std::setw(10) << statistics.samples << std::fixed << std::setprecision(3)
+				<< std::setw(11) << statistics.mean << std::setw(11) << statistics.p50
+				<< std::setw(11) << statistics.p99 << std::setw(11) << statistics.max << "\n";
+		}
+		out << std::defaultfloat;
+	}
+
+	//Same statistics as a JSON object keyed by stage name
+	void writeJSON(std::ostream& out)
+	{
+		out << "{";
+		bool first = true;
+		for (int i = 0; i < static_cast<int>(FrameStage::Count); i++) {
+			const StageStatistics statistics = getStatistics(static_cast<FrameStage>(i));
+			if (statistics.samples == 0) {
+				continue;
+			}
+			out << (first ? "" : ", ") << "\"" << getFrameStageName(static_cast<FrameStage>(i)) << "\": {"
+				<< "\"samples\": " << statistics.samples << ", \"mean\": " << statistics.mean
+				<< ", \"p50\": " << statistics.p50 << ", \"p99\": " << statistics.p99
+				<< ", \"max\": " << statistics.max << "}";
+			first = false;
+		}
+		out << "}";
+	}
+
+private:
+	struct Stage {
+		std::mutex mutex;
+		std::vector<double> samples;
+		size_t next = 0;
+	};
+
+	Stage stages[static_cast<int>(FrameStage::Count)];
+
+	//Index of the percentile-th percentile in count sorted samples, the smallest sample with at least
+	//that share of the samples at or below it, i.e. ceil(percentile / 100 * count) - 1
+	static size_t getNearestRank(size_t count, size_t percentile)
+	{
+		return (count * percentile + 99) / 100 - 1;
+	}
+};
+
+//Records the time between its construction and destruction as one sample of a stage,
+//and as a span named after the stage if tracing is enabled
+class ScopedStageTimer
+{
+public:
+	ScopedStageTimer(FrameStatistics& statistics, FrameStage stage)
+		: statistics(statistics), stage(stage), start(std::chrono::high_resolution_clock::now())
+	{
+	}
+
+	~ScopedStageTimer()
+	{
+		const auto end = std::chrono::high_resolution_clock::now();
+		statistics.record(stage, std::chrono::duration<double, std::milli>(end - start).count());
+		TraceRecorder::getInstance().recordSpan(getFrameStageName(stage), start, end);
+	}
+
+	ScopedStageTimer(const ScopedStageTimer&) = delete;
+	ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+private:
+	FrameStatistics& statistics;
+	FrameStage stage;
+	std::chrono::high_resolution_clock::time_point start;
+};
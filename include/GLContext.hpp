@@ -0,0 +1,60 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <stdexcept>
+
+//Returns nullptr and leaves GLFW terminated on failure
+inline GLFWwindow* createContextWindowOnCurrentPlatform(int width, int height, const char* title, bool hidden)
+{
+	if (!glfwInit()) {
+		return nullptr;
+	}
+
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef __APPLE__
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+	if (hidden) {
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#if defined(GLFW_PLATFORM_NULL) && defined(GLFW_OSMESA_CONTEXT_API)
+		if (glfwGetPlatform() == GLFW_PLATFORM_NULL) {
+			glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+		}
+#endif
+	}
+
+	GLFWwindow* window = glfwCreateWindow(width, height, title, nullptr, nullptr);
+	if (window == nullptr) {
+		glfwTerminate();
+	}
+	return window;
+}
+
+//Creates a window with a GL 3.3 core context, makes the context current and loads the GL functions.
+//A hidden window falls back to GLFW's null platform with an OSMesa context when available and there is no display.
+//The caller destroys the window and terminates GLFW, nothing is left behind when this throws.
+inline GLFWwindow* createContextWindow(int width, int height, const char* title, bool hidden)
+{
+	GLFWwindow* window = createContextWindowOnCurrentPlatform(width, height, title, hidden);
+#if defined(GLFW_PLATFORM_NULL) && defined(GLFW_OSMESA_CONTEXT_API)
+	if (window == nullptr && hidden) {
+		glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+		window = createContextWindowOnCurrentPlatform(width, height, title, hidden);
+	}
+#endif
+	if (window == nullptr) {
+		throw std::runtime_error("Failed to create the window!");
+	}
+	glfwMakeContextCurrent(window);
+
+	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		throw std::runtime_error("Failed to initialize GLAD");
+	}
+	return window;
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+//Basic types of the CPU ray tracing core: rays, bounding boxes, hits and triangle meshes
+
+struct Ray
+{
+	glm::vec3 origin;
+	glm::vec3 direction;
+	float tMin = 0.0f;
+	float tMax = std::numeric_limits<float>::infinity();
+
+	Ray() {}
+	Ray(const glm::vec3& origin, const glm::vec3& direction, float tMin = 0.0f, float tMax = std::numeric_limits<float>::infinity())
+		: origin(origin), direction(direction), tMin(tMin), tMax(tMax) {}
+};
+
+//Axis-aligned bounding box, empty (min > max) until something is added
+struct Aabb
+{
+	glm::vec3 min = glm::vec3(std::numeric_limits<float>::infinity());
+	glm::vec3 max = glm::vec3(-std::numeric_limits<float>::infinity());
+
+	void extend(const glm::vec3& point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	void extend(const Aabb& box)
+	{
+		min = glm::min(min, box.min);
+		max = glm::max(max, box.max);
+	}
+
+	bool isEmpty() const
+	{
+		return min.x > max.x || min.y > max.y || min.z > max.z;
+	}
+
+	glm::vec3 getCenter() const
+	{
+		return (min + max) * 0.5f;
+	}
+
+	glm::vec3 getExtent() const
+	{
+		return max - min;
+	}
+
+	float getSurfaceArea() const
+	{
+		if (isEmpty()) {
+			return 0.0f;
+		}
+		const glm::vec3 extent = getExtent();
+		return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+	}
+
+	int getLargestAxis() const
+	{
+		const glm::vec3 extent = getExtent();
+		return extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+	}
+};
+
+struct Hit
+{
+	static const uint32_t NONE = 0xffffffffu;
+
+	float t = std::numeric_limits<float>::infinity();
+	//Barycentric coordinates of the hit point with respect to the second and third vertex
+	float u = 0.0f;
+	float v = 0.0f;
+	uint32_t triangle = NONE;
+
+	bool isHit() const
+	{
+		return triangle != NONE;
+	}
+};
+
+//Indexed triangles with an optional color per triangle
+struct TriangleMesh
+{
+	std::vector<glm::vec3> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<glm::vec3> colors;
+
+	size_t getTriangleCount() const
+	{
+		return indices.size() / 3;
+	}
+
+	uint32_t addVertex(const glm::vec3& position)
+	{
+		vertices.push_back(position);
+		return static_cast<uint32_t>(vertices.size() - 1);
+	}
+
+	void addTriangle(uint32_t a, uint32_t b, uint32_t c, const glm::vec3& color = glm::vec3(0.8f))
+	{
+		indices.push_back(a);
+		indices.push_back(b);
+		indices.push_back(c);
+		colors.push_back(color);
+	}
+
+	const glm::vec3& getVertex(size_t triangle, int corner) const
+	{
+		return vertices[indices[triangle * 3 + corner]];
+	}
+
+	Aabb getTriangleBounds(size_t triangle) const
+	{
+		Aabb bounds;
+		bounds.extend(getVertex(triangle, 0));
+		bounds.extend(getVertex(triangle, 1));
+		bounds.extend(getVertex(triangle, 2));
+		return bounds;
+	}
+
+	glm::vec3 getNormal(size_t triangle) const
+	{
+		const glm::vec3 v0 = getVertex(triangle, 0);
+		return glm::normalize(glm::cross(getVertex(triangle, 1) - v0, getVertex(triangle, 2) - v0));
+	}
+
+	glm::vec3 getColor(size_t triangle) const
+	{
+		return triangle < colors.size() ? colors[triangle] : glm::vec3(0.8f);
+	}
+};
+
+//Triangle stored the way the intersection test wants it, one vertex and two edges
+struct PrecomputedTriangle
+{
+	glm::vec3 v0;
+	glm::vec3 edge1;
+	glm::vec3 edge2;
+	uint32_t index;
+
+	PrecomputedTriangle() : index(0) {}
+	PrecomputedTriangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, uint32_t index)
+		: v0(v0), edge1(v1 - v0), edge2(v2 - v0), index(index) {}
+};
+
+//Möller-Trumbore test, records the hit and shortens the ray if it is closer than ray.tMax
+inline bool intersectTriangle(Ray& ray, const PrecomputedTriangle& triangle, Hit& hit)
+{
+	const glm::vec3 p = glm::cross(ray.direction, triangle.edge2);
+	const float determinant = glm::dot(triangle.edge1, p);
+	if (std::fabs(determinant) < 1e-12f) {
+		return false;
+	}
+	const float inverseDeterminant = 1.0f / determinant;
+
+	const glm::vec3 s = ray.origin - triangle.v0;
+	const float u = glm::dot(s, p) * inverseDeterminant;
+	if (u < 0.0f || u > 1.0f) {
+		return false;
+	}
+
+	const glm::vec3 q = glm::cross(s, triangle.edge1);
+	const float v = glm::dot(ray.direction, q) * inverseDeterminant;
+	if (v < 0.0f || u + v > 1.0f) {
+		return false;
+	}
+
+	const float t = glm::dot(triangle.edge2, q) * inverseDeterminant;
+	if (t <= ray.tMin || t >= ray.tMax) {
+		return false;
+	}
+
+	ray.tMax = t;
+	hit.t = t;
+	hit.u = u;
+	hit.v = v;
+	hit.triangle = triangle.index;
+	return true;
+}
+
+//Ray data reused by every box test of a traversal
+struct RayBoxTest
+{
+	glm::vec3 inverseDirection;
+	glm::vec3 scaledOrigin;
+	int directionNegative[3];
+
+	explicit RayBoxTest(const Ray& ray)
+	{
+		for (int axis = 0; axis < 3; axis++) {
+			//A zero direction turns into a huge reciprocal instead of an infinity, which keeps 0 * inf NaNs out of the slabs
+			const float direction = ray.direction[axis];
+			inverseDirection[axis] = 1.0f / (std::fabs(direction) > 1e-20f ? direction : std::copysign(1e-20f, direction));
+			scaledOrigin[axis] = -ray.origin[axis] * inverseDirection[axis];
+			directionNegative[axis] = inverseDirection[axis] < 0.0f ? 1 : 0;
+		}
+	}
+
+	//Slab test, returns the entry distance or infinity if the box is missed within [tMin, tMax]
+	float intersect(const Aabb& box, float tMin, float tMax) const
+	{
+		float entry = tMin;
+		float exit = tMax;
+		for (int axis = 0; axis < 3; axis++) {
+			const float t0 = box.min[axis] * inverseDirection[axis] + scaledOrigin[axis];
+			const float t1 = box.max[axis] * inverseDirection[axis] + scaledOrigin[axis];
+			entry = std::max(entry, std::min(t0, t1));
+			exit = std::min(exit, std::max(t0, t1));
+		}
+		return entry <= exit ? entry : std::numeric_limits<float>::infinity();
+	}
+};
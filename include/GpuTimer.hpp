@@ -0,0 +1,109 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "FrameStatistics.hpp"
+
+//Pool of GL_TIME_ELAPSED queries measuring how long the GPU spends on a stage.
+//Results are read back frames later, once they are available, so timing never stalls the pipeline;
+//if every query is still in flight the stage simply goes untimed for that frame.
+class GpuTimerPool
+{
+public:
+	void create(int queryCount)
+	{
+		freeQueries.resize(queryCount);
+		glGenQueries(queryCount, freeQueries.data());
+		allQueries = freeQueries;
+	}
+
+	void destroy()
+	{
+		if (!allQueries.empty()) {
+			glDeleteQueries(static_cast<GLsizei>(allQueries.size()), allQueries.data());
+		}
+		allQueries.clear();
+		freeQueries.clear();
+		pending.clear();
+		activeQuery = 0;
+	}
+
+	//Only one stage can be timed at a time, returns false if no query was free
+	bool begin(FrameStage stage)
+	{
+		if (freeQueries.empty() || activeQuery != 0) {
+			return false;
+		}
+		activeQuery = freeQueries.back();
+		freeQueries.pop_back();
+		glBeginQuery(GL_TIME_ELAPSED, activeQuery);
+		pending.push_back({ activeQuery, stage });
+		return true;
+	}
+
+	void end()
+	{
+		if (activeQuery != 0) {
+			glEndQuery(GL_TIME_ELAPSED);
+			activeQuery = 0;
+		}
+	}
+
+	//Records the results that are available by now, without waiting for the others
+	void collect(FrameStatistics& statistics)
+	{
+		while (!pending.empty() && pending.front().id != activeQuery) {
+			const PendingQuery query = pending.front();
+			GLint available = 0;
+			glGetQueryObjectiv(query.id, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				break;
+			}
+
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(query.id, GL_QUERY_RESULT, &nanoseconds);
+			statistics.record(query.stage, nanoseconds / 1.0e6);
+			pending.pop_front();
+			freeQueries.push_back(query.id);
+		}
+	}
+
+private:
+	struct PendingQuery {
+		GLuint id;
+		FrameStage stage;
+	};
+
+	std::vector<GLuint> allQueries;
+	std::vector<GLuint> freeQueries;
+	std::deque<PendingQuery> pending;
+	GLuint activeQuery = 0;
+};
+
+//Times the GL commands issued during its lifetime on the GPU
+class ScopedGpuTimer
+{
+public:
+	ScopedGpuTimer(GpuTimerPool& pool, FrameStage stage)
+		: pool(pool), started(pool.begin(stage))
+	{
+	}
+
+	~ScopedGpuTimer()
+	{
+		if (started) {
+			pool.end();
+		}
+	}
+
+	ScopedGpuTimer(const ScopedGpuTimer&) = delete;
+	ScopedGpuTimer& operator=(const ScopedGpuTimer&) = delete;
+
+private:
+	GpuTimerPool& pool;
+	bool started;
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "FrameBuffer.hpp"
+
+//Writes the frame as a little-endian Portable Float Map, keeping the full float values
+inline void writePFM(const std::string& path, const FrameView& frame)
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Failed to open " + path + " for writing");
+	}
+
+	//A negative scale marks little-endian data, rows are stored bottom to top so the frame's row 0 goes last
+	file << "PF\n" << frame.width << " " << frame.height << "\n-1.0\n";
+	for (int y = frame.height - 1; y >= 0; y--) {
+		file.write(reinterpret_cast<const char*>(frame.row(y)), static_cast<std::streamsize>(frame.width * sizeof(glm::vec3)));
+	}
+
+	if (!file) {
+		throw std::runtime_error("Failed to write " + path);
+	}
+}
+
+//Writes the frame as a binary 8-bit PPM, clamped to [0, 1] and gamma encoded for quick inspection
+inline void writePPM(const std::string& path, const FrameView& frame)
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Failed to open " + path + " for writing");
+	}
+
+	file << "P6\n" << frame.width << " " << frame.height << "\n255\n";
+	std::vector<uint8_t> row(static_cast<size_t>(frame.width) * 3);
+	for (int y = 0; y < frame.height; y++) {
+		const glm::vec3* pixels = frame.row(y);
+		for (int x = 0; x < frame.width; x++) {
+			for (int c = 0; c < 3; c++) {
+				const float value = std::min(std::max(pixels[x][c], 0.0f), 1.0f);
+				row[x * 3 + c] = static_cast<uint8_t>(std::pow(value, 1.0f / 2.2f) * 255.0f + 0.5f);
+			}
+		}
+		file.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size()));
+	}
+
+	if (!file) {
+		throw std::runtime_error("Failed to write " + path);
+	}
+}
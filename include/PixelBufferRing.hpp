@@ -0,0 +1,118 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "TraceRecorder.hpp"
+
+#include <cstddef>
+#include <vector>
+
+//Ring of pixel unpack buffers used to stream texture uploads asynchronously.
+//The CPU fills buffer N+1 while the GPU is still reading from buffer N; a fence
+//placed after each upload tells us when a buffer can safely be written again.
+class PixelBufferRing
+{
+public:
+	void create(int ringSize, size_t initialSize)
+	{
+		buffers.resize(ringSize);
+		fences.assign(ringSize, nullptr);
+		glGenBuffers(ringSize, buffers.data());
+		bufferSize = 0;
+		reserve(initialSize);
+		current = 0;
+	}
+
+	void destroy()
+	{
+		for (GLsync& fence : fences) {
+			if (fence != nullptr) {
+				glDeleteSync(fence);
+				fence = nullptr;
+			}
+		}
+		if (!buffers.empty()) {
+			glDeleteBuffers(static_cast<GLsizei>(buffers.size()), buffers.data());
+			buffers.clear();
+		}
+		bufferSize = 0;
+	}
+
+	//Advances to the next buffer of the ring and maps it for writing.
+	//The buffer stays bound to GL_PIXEL_UNPACK_BUFFER until unbind() is called.
+	//Returns nullptr if the buffer could not be mapped.
+	void* map(size_t size)
+	{
+		if (buffers.empty()) {
+			return nullptr;
+		}
+
+		current = (current + 1) % buffers.size();
+		waitForFence(current);
+
+		if (size > bufferSize) {
+			reserve(size);
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[current]);
+		//The fence guarantees that the GPU is done with this buffer, so no implicit synchronization is needed
+		return glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	}
+
+	//Returns false if the contents of the buffer were lost while it was mapped
+	bool unmap()
+	{
+		return glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+	}
+
+	//Call after the glTexSubImage2D sourcing from the current buffer has been issued
+	void fence()
+	{
+		fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	void unbind()
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	int size() const
+	{
+		return static_cast<int>(buffers.size());
+	}
+
+private:
+	std::vector<GLuint> buffers;
+	std::vector<GLsync> fences;
+	size_t bufferSize = 0;
+	size_t current = 0;
+
+	void waitForFence(size_t index)
+	{
+		GLsync& fence = fences[index];
+		if (fence == nullptr) {
+			return;
+		}
+
+		ScopedTraceSpan span("pixelBufferFence");
+		GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while (result == GL_TIMEOUT_EXPIRED) {
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		}
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+	//Grows all buffers of the ring; every fence has to be retired first since the storage gets orphaned
+	void reserve(size_t size)
+	{
+		for (size_t i = 0; i < buffers.size(); i++) {
+			waitForFence(i);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[i]);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		bufferSize = size;
+	}
+};
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RAYTRACING_OPENGLVIEWER_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(RAYTRACING_OPENGLVIEWER_SSE2) && (defined(__F16C__) || defined(__AVX2__))
+#define RAYTRACING_OPENGLVIEWER_F16C
+#include <immintrin.h>
+#endif
+
+//Formats frames can be uploaded in. Everything but RGB32F is converted on the CPU first,
+//trading a little precision for 1.5x (RGBA16F) to 3x (4-byte formats) less data to copy.
+enum class UploadFormat {
+	RGB32F,
+	RGBA16F,
+	RGB10_A2,
+	SRGB8_A8,
+	RGB9_E5
+};
+
+struct PixelFormatInfo {
+	GLenum internalFormat;
+	GLenum format;
+	GLenum type;
+	size_t pixelSize;
+	const char* name;
+};
+
+inline PixelFormatInfo getPixelFormatInfo(UploadFormat uploadFormat)
+{
+	switch (uploadFormat) {
+	case UploadFormat::RGBA16F:
+		return { GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8, "RGBA16F" };
+	case UploadFormat::RGB10_A2:
+		return { GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, 4, "RGB10_A2" };
+	case UploadFormat::SRGB8_A8:
+		return { GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, "SRGB8_A8" };
+	case UploadFormat::RGB9_E5:
+		return { GL_RGB9_E5, GL_RGB, GL_UNSIGNED_INT_5_9_9_9_REV, 4, "RGB9_E5" };
+	case UploadFormat::RGB32F:
+	default:
+		return { GL_RGB32F, GL_RGB, GL_FLOAT, 12, "RGB32F" };
+	}
+}
+
+namespace PixelConversion {
+
+	inline uint32_t floatBits(float value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	inline float bitsToFloat(uint32_t bits)
+	{
+		float value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	//Round-to-nearest-even float to half conversion, overflows to infinity
+	inline uint16_t floatToHalf(float value)
+	{
+		uint32_t bits = floatBits(value);
+		const uint32_t sign = bits & 0x80000000u;
+		bits ^= sign;
+
+		uint32_t half;
+		if (bits >= 0x47800000u) {
+			//Too large for a half, infinity or NaN
+			half = bits > 0x7f800000u ? 0x7e00u : 0x7c00u;
+		}
+		else if (bits < 0x38800000u) {
+			//Subnormal half or zero, adding 0.5 lets the FPU do the rounding
+			half = floatBits(bitsToFloat(bits) + 0.5f) - 0x3f000000u;
+		}
+		else {
+			const uint32_t mantissaOdd = (bits >> 13) & 1u;
+			bits += (static_cast<uint32_t>(15 - 127) << 23) + 0xfffu + mantissaOdd;
+			half = bits >> 13;
+		}
+		return static_cast<uint16_t>(half | (sign >> 16));
+	}
+
+	inline float clampUnit(float value)
+	{
+		//Also maps NaN to 0
+		return value > 0.0f ? (value < 1.0f ? value : 1.0f) : 0.0f;
+	}
+
+	//Approximation of the sRGB transfer function, within one step of the exact curve at 8 bits;
+	//it only needs square roots so it vectorizes
+	inline float linearToSrgb(float value)
+	{
+		value = clampUnit(value);
+		if (value <= 0.0031308f) {
+			return 12.92f * value;
+		}
+		const float s1 = std::sqrt(value);
+		const float s2 = std::sqrt(s1);
+		const float s3 = std::sqrt(s2);
+		return clampUnit(0.662002687f * s1 + 0.684122060f * s2 - 0.323583601f * s3 - 0.0225411470f * value);
+	}
+
+	inline uint32_t packRGB10A2(const glm::vec3& pixel)
+	{
+		const uint32_t r = static_cast<uint32_t>(clampUnit(pixel.x) * 1023.0f + 0.5f);
+		const uint32_t g = static_cast<uint32_t>(clampUnit(pixel.y) * 1023.0f + 0.5f);
+		const uint32_t b = static_cast<uint32_t>(clampUnit(pixel.z) * 1023.0f + 0.5f);
+		return r | (g << 10) | (b << 20) | (3u << 30);
+	}
+
+	inline uint32_t packSRGB8A8(const glm::vec3& pixel)
+	{
+		const uint32_t r = static_cast<uint32_t>(linearToSrgb(pixel.x) * 255.0f + 0.5f);
+		const uint32_t g = static_cast<uint32_t>(linearToSrgb(pixel.y) * 255.0f + 0.5f);
+		const uint32_t b = static_cast<uint32_t>(linearToSrgb(pixel.z) * 255.0f + 0.5f);
+		return r | (g << 8) | (b << 16) | (0xffu << 24);
+	}
+
+	//Largest value representable with 9 mantissa bits and a shared exponent biased by 15
+	const float RGB9E5_MAX = 65408.0f;
+
+	//Shared exponent encoding as described in EXT_texture_shared_exponent
+	inline uint32_t packRGB9E5(const glm::vec3& pixel)
+	{
+		//Negative values and NaN become 0
+		const float r = pixel.x > 0.0f ? std::min(pixel.x, RGB9E5_MAX) : 0.0f;
+		const float g = pixel.y > 0.0f ? std::min(pixel.y, RGB9E5_MAX) : 0.0f;
+		const float b = pixel.z > 0.0f ? std::min(pixel.z, RGB9E5_MAX) : 0.0f;
+		const float maxComponent = std::max(r, std::max(g, b));
+
+		//floor(log2(maxComponent)) straight from the exponent bits, zero and denormals end up at the minimum
+		int exponent = std::max(-16, static_cast<int>((floatBits(maxComponent) >> 23) & 0xff) - 127) + 16;
+		float scale = bitsToFloat(static_cast<uint32_t>(127 - (exponent - 24)) << 23);
+		if (static_cast<uint32_t>(maxComponent * scale + 0.5f) == 512u) {
+			exponent++;
+			scale *= 0.5f;
+		}
+
+		const uint32_t rm = static_cast<uint32_t>(r * scale + 0.5f);
+		const uint32_t gm = static_cast<uint32_t>(g * scale + 0.5f);
+		const uint32_t bm = static_cast<uint32_t>(b * scale + 0.5f);
+		return rm | (gm << 9) | (bm << 18) | (static_cast<uint32_t>(exponent) << 27);
+	}
+
+	inline void convertScalar(UploadFormat uploadFormat, const glm::vec3* source, void* destination, size_t count)
+	{
+		switch (uploadFormat) {
+		case UploadFormat::RGBA16F: {
+			uint16_t* out = static_cast<uint16_t*>(destination);
+			for (size_t i = 0; i < count; i++, out += 4) {
+				out[0] = floatToHalf(source[i].x);
+				out[1] = floatToHalf(source[i].y);
+				out[2] = floatToHalf(source[i].z);
+				out[3] = 0x3c00;
+			}
+			break;
+		}
+		case UploadFormat::RGB10_A2: {
+			uint32_t* out = static_cast<uint32_t*>(destination);
+			for (size_t i = 0; i < count; i++) {
+				out[i] = packRGB10A2(source[i]);
+			}
+			break;
+		}
+		case UploadFormat::SRGB8_A8: {
+			uint32_t* out = static_cast<uint32_t*>(destination);
+			for (size_t i = 0; i < count; i++) {
+				out[i] = packSRGB8A8(source[i]);
+			}
+			break;
+		}
+		case UploadFormat::RGB9_E5: {
+			uint32_t* out = static_cast<uint32_t*>(destination);
+			for (size_t i = 0; i < count; i++) {
+				out[i] = packRGB9E5(source[i]);
+			}
+			break;
+		}
+		case UploadFormat::RGB32F:
+		default:
+			std::memcpy(destination, source, count * sizeof(glm::vec3));
+			break;
+		}
+	}
+
+#ifdef RAYTRACING_OPENGLVIEWER_SSE2
+	//Loads 4 consecutive RGB pixels and splits them into one register per channel
+	inline void loadPixels4(const glm::vec3* pixels, __m128& r, __m128& g, __m128& b)
+	{
+		const float* p = &pixels[0].x;
+		const __m128 a0 = _mm_loadu_ps(p);		//r0 g0 b0 r1
+		const __m128 a1 = _mm_loadu_ps(p + 4);	//g1 b1 r2 g2
+		const __m128 a2 = _mm_loadu_ps(p + 8);	//b2 r3 g3 b3
+
+		const __m128 rHigh = _mm_shuffle_ps(a1, a2, _MM_SHUFFLE(1, 0, 0, 2));
+		r = _mm_shuffle_ps(a0, rHigh, _MM_SHUFFLE(3, 0, 3, 0));
+		const __m128 gLow = _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(0, 0, 1, 1));
+		const __m128 gHigh = _mm_shuffle_ps(a1, a2, _MM_SHUFFLE(2, 2, 3, 3));
+		g = _mm_shuffle_ps(gLow, gHigh, _MM_SHUFFLE(3, 1, 2, 0));
+		const __m128 bLow = _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(1, 1, 2, 2));
+		const __m128 bHigh = _mm_shuffle_ps(a2, a2, _MM_SHUFFLE(3, 3, 0, 0));
+		b = _mm_shuffle_ps(bLow, bHigh, _MM_SHUFFLE(2, 0, 2, 0));
+	}
+
+	inline __m128 clampUnit4(__m128 value)
+	{
+		//max with 0 first so NaN becomes 0
+		return _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	}
+
+	inline __m128i quantize4(__m128 unitValue, float maximum)
+	{
+		return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(unitValue, _mm_set1_ps(maximum)), _mm_set1_ps(0.5f)));
+	}
+
+	//4-wide floatToHalf, each 32-bit lane holds a half in its low 16 bits (sign extended)
+	inline __m128i floatToHalf4(__m128 value)
+	{
+#ifdef RAYTRACING_OPENGLVIEWER_F16C
+		return _mm_cvtepi16_epi32(_mm_cvtps_ph(value, _MM_FROUND_TO_NEAREST_INT));
+#else
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+		const __m128 sign = _mm_and_ps(value, signMask);
+		const __m128 absolute = _mm_andnot_ps(signMask, value);
+		const __m128i bits = _mm_castps_si128(absolute);
+
+		const __m128i isRegular = _mm_cmpgt_epi32(_mm_set1_epi32(0x47800000), bits);
+		const __m128i nanBit = _mm_and_si128(_mm_castps_si128(_mm_cmpunord_ps(absolute, absolute)), _mm_set1_epi32(0x200));
+		const __m128i special = _mm_or_si128(nanBit, _mm_set1_epi32(0x7c00));
+
+		const __m128i isSubnormal = _mm_cmpgt_epi32(_mm_set1_epi32(0x38800000), bits);
+		const __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absolute, _mm_set1_ps(0.5f))), _mm_set1_epi32(0x3f000000));
+
+		const __m128i mantissaOdd = _mm_srai_epi32(_mm_slli_epi32(bits, 31 - 13), 31);
+		const __m128i rounded = _mm_sub_epi32(_mm_add_epi32(bits, _mm_set1_epi32(0xfff - ((127 - 15) << 23))), mantissaOdd);
+		const __m128i normal = _mm_srli_epi32(rounded, 13);
+
+		const __m128i finite = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal), _mm_andnot_si128(isSubnormal, normal));
+		const __m128i joined = _mm_or_si128(_mm_and_si128(isRegular, finite), _mm_andnot_si128(isRegular, special));
+		return _mm_or_si128(joined, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+#endif
+	}
+
+	inline __m128 linearToSrgb4(__m128 value)
+	{
+		value = clampUnit4(value);
+		const __m128 s1 = _mm_sqrt_ps(value);
+		const __m128 s2 = _mm_sqrt_ps(s1);
+		const __m128 s3 = _mm_sqrt_ps(s2);
+		__m128 curve = _mm_mul_ps(_mm_set1_ps(0.662002687f), s1);
+		curve = _mm_add_ps(curve, _mm_mul_ps(_mm_set1_ps(0.684122060f), s2));
+		curve = _mm_sub_ps(curve, _mm_mul_ps(_mm_set1_ps(0.323583601f), s3));
+		curve = _mm_sub_ps(curve, _mm_mul_ps(_mm_set1_ps(0.0225411470f), value));
+		const __m128 linear = _mm_mul_ps(_mm_set1_ps(12.92f), value);
+		const __m128 isLinear = _mm_cmple_ps(value, _mm_set1_ps(0.0031308f));
+		return clampUnit4(_mm_or_ps(_mm_and_ps(isLinear, linear), _mm_andnot_ps(isLinear, curve)));
+	}
+
+	inline __m128i max4(__m128i a, __m128i b)
+	{
+		const __m128i aGreater = _mm_cmpgt_epi32(a, b);
+		return _mm_or_si128(_mm_and_si128(aGreater, a), _mm_andnot_si128(aGreater, b));
+	}
+
+	inline __m128i packRGB9E5x4(__m128 r, __m128 g, __m128 b)
+	{
+		const __m128 maximum = _mm_set1_ps(RGB9E5_MAX);
+		r = _mm_min_ps(_mm_max_ps(r, _mm_setzero_ps()), maximum);
+		g = _mm_min_ps(_mm_max_ps(g, _mm_setzero_ps()), maximum);
+		b = _mm_min_ps(_mm_max_ps(b, _mm_setzero_ps()), maximum);
+		const __m128 maxComponent = _mm_max_ps(r, _mm_max_ps(g, b));
+
+		const __m128i biasedExponent = _mm_srli_epi32(_mm_castps_si128(maxComponent), 23);
+		__m128i exponent = _mm_add_epi32(max4(_mm_sub_epi32(biasedExponent, _mm_set1_epi32(127)), _mm_set1_epi32(-16)), _mm_set1_epi32(16));
+		//2^-(exponent - 24) built directly from its bits
+		__m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(_mm_set1_epi32(127 + 24), exponent), 23));
+
+		const __m128i maxMantissa = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(maxComponent, scale), _mm_set1_ps(0.5f)));
+		const __m128i overflow = _mm_cmpeq_epi32(maxMantissa, _mm_set1_epi32(512));
+		exponent = _mm_sub_epi32(exponent, overflow);
+		scale = _mm_or_ps(_mm_and_ps(_mm_castsi128_ps(overflow), _mm_mul_ps(scale, _mm_set1_ps(0.5f))),
+			_mm_andnot_ps(_mm_castsi128_ps(overflow), scale));
+
+		const __m128 half = _mm_set1_ps(0.5f);
+		const __m128i rm = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(r, scale), half));
+		const __m128i gm = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(g, scale), half));
+		const __m128i bm = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(b, scale), half));
+		return _mm_or_si128(_mm_or_si128(rm, _mm_slli_epi32(gm, 9)), _mm_or_si128(_mm_slli_epi32(bm, 18), _mm_slli_epi32(exponent, 27)));
+	}
+
+	//Converts the largest multiple of 4 pixels, returns how many were converted
+	inline size_t convertSSE2(UploadFormat uploadFormat, const glm::vec3* source, void* destination, size_t count)
+	{
+		const size_t vectorCount = count & ~static_cast<size_t>(3);
+		__m128 r, g, b;
+
+		switch (uploadFormat) {
+		case UploadFormat::RGBA16F: {
+			char* out = static_cast<char*>(destination);
+			const __m128i one = _mm_set1_epi32(0x3c00);
+			for (size_t i = 0; i < vectorCount; i += 4, out += 32) {
+				loadPixels4(source + i, r, g, b);
+				//r0..r3 g0..g3 and b0..b3 a0..a3 as 16-bit values, then interleaved to r g b a per pixel
+				const __m128i rg = _mm_packs_epi32(floatToHalf4(r), floatToHalf4(g));
+				const __m128i ba = _mm_packs_epi32(floatToHalf4(b), one);
+				const __m128i rgPairs = _mm_unpacklo_epi16(rg, _mm_srli_si128(rg, 8));
+				const __m128i baPairs = _mm_unpacklo_epi16(ba, _mm_srli_si128(ba, 8));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi32(rgPairs, baPairs));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_unpackhi_epi32(rgPairs, baPairs));
+			}
+			break;
+		}
+		case UploadFormat::RGB10_A2: {
+			uint32_t* out = static_cast<uint32_t*>(destination);
+			const __m128i alpha = _mm_set1_epi32(static_cast<int>(3u << 30));
+			for (size_t i = 0; i < vectorCount; i += 4) {
+				loadPixels4(source + i, r, g, b);
+				const __m128i rq = quantize4(clampUnit4(r), 1023.0f);
+				const __m128i gq = quantize4(clampUnit4(g), 1023.0f);
+				const __m128i bq = quantize4(clampUnit4(b), 1023.0f);
+				const __m128i packed = _mm_or_si128(_mm_or_si128(rq, _mm_slli_epi32(gq, 10)), _mm_or_si128(_mm_slli_epi32(bq, 20), alpha));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+			}
+			break;
+		}
+		case UploadFormat::SRGB8_A8: {
+			uint32_t* out = static_cast<uint32_t*>(destination);
+			const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xffu << 24));
+			for (size_t i = 0; i < vectorCount; i += 4) {
+				loadPixels4(source + i, r, g, b);
+				const __m128i rq = quantize4(linearToSrgb4(r), 255.0f);
+				const __m128i gq = quantize4(linearToSrgb4(g), 255.0f);
+				const __m128i bq = quantize4(linearToSrgb4(b), 255.0f);
+				const __m128i packed = _mm_or_si128(_mm_or_si128(rq, _mm_slli_epi32(gq, 8)), _mm_or_si128(_mm_slli_epi32(bq, 16), alpha));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+			}
+			break;
+		}
+		case UploadFormat::RGB9_E5: {
+			uint32_t* out = static_cast<uint32_t*>(destination);
+			for (size_t i = 0; i < vectorCount; i += 4) {
+				loadPixels4(source + i, r, g, b);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packRGB9E5x4(r, g, b));
+			}
+			break;
+		}
+		case UploadFormat::RGB32F:
+		default:
+			return 0;
+		}
+		return vectorCount;
+	}
+#endif
+
+}
+
+//Converts count RGB float pixels to the upload format, destination must hold count * pixelSize bytes
+inline void convertPixels(UploadFormat uploadFormat, const glm::vec3* source, void* destination, size_t count)
+{
+	size_t converted = 0;
+#ifdef RAYTRACING_OPENGLVIEWER_SSE2
+	converted = PixelConversion::convertSSE2(uploadFormat, source, destination, count);
+#endif
+	if (converted < count) {
+		char* rest = static_cast<char*>(destination) + converted * getPixelFormatInfo(uploadFormat).pixelSize;
+		PixelConversion::convertScalar(uploadFormat, source + converted, rest, count - converted);
+	}
+}
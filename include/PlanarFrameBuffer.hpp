@@ -0,0 +1,128 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "AlignedAllocator.hpp"
+#include "FrameBuffer.hpp"
+
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RAYTRACING_OPENGLVIEWER_SSE2
+#include <emmintrin.h>
+#endif
+
+//Writable view of a frame stored as one plane per channel (structure of arrays).
+//Every row of every plane starts on a 64-byte boundary and rows are stride floats apart,
+//so kernels can use aligned full-width vector loads and stores over a row.
+//Rows are ordered like those of FrameView, row 0 is the top of the image.
+//alpha is nullptr unless the buffer was created with an alpha plane, e.g. for sample counts.
+struct PlanarFrameView
+{
+	float* red = nullptr;
+	float* green = nullptr;
+	float* blue = nullptr;
+	float* alpha = nullptr;
+	int width = 0;
+	int height = 0;
+	int stride = 0;
+
+	float* redRow(int y) const { return red + static_cast<size_t>(y) * stride; }
+	float* greenRow(int y) const { return green + static_cast<size_t>(y) * stride; }
+	float* blueRow(int y) const { return blue + static_cast<size_t>(y) * stride; }
+	float* alphaRow(int y) const { return alpha + static_cast<size_t>(y) * stride; }
+};
+
+//Owns the planes of a frame of any size
+class PlanarFrameBuffer
+{
+public:
+	//Floats a row is padded to, one cache line
+	static const int ROW_ALIGNMENT = 16;
+
+	//Keeps the pixels if the layout does not change, otherwise the planes are cleared to zero
+	void resize(int newWidth, int newHeight, bool withAlpha = false)
+	{
+		if (newWidth == width && newHeight == height && withAlpha == hasAlpha) {
+			return;
+		}
+		width = newWidth;
+		height = newHeight;
+		hasAlpha = withAlpha;
+		stride = (newWidth + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT;
+		const size_t planeSize = static_cast<size_t>(stride) * height;
+		for (int i = 0; i < 4; i++) {
+			if (i < 3 || hasAlpha) {
+				planes[i].assign(planeSize, 0.0f);
+			}
+			else {
+				planes[i].clear();
+			}
+		}
+	}
+
+	PlanarFrameView view()
+	{
+		PlanarFrameView frame;
+		frame.red = planes[0].data();
+		frame.green = planes[1].data();
+		frame.blue = planes[2].data();
+		frame.alpha = hasAlpha ? planes[3].data() : nullptr;
+		frame.width = width;
+		frame.height = height;
+		frame.stride = stride;
+		return frame;
+	}
+
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	int getStride() const { return stride; }
+
+private:
+	AlignedVector<float> planes[4];
+	int width = 0;
+	int height = 0;
+	int stride = 0;
+	bool hasAlpha = false;
+};
+
+namespace PixelConversion {
+
+	//Writes count rgb pixels from three planes as interleaved glm::vec3
+	inline void interleaveRGB(const float* red, const float* green, const float* blue, glm::vec3* destination, size_t count)
+	{
+		size_t i = 0;
+#ifdef RAYTRACING_OPENGLVIEWER_SSE2
+		float* output = &destination[0].x;
+		for (; i + 4 <= count; i += 4) {
+			const __m128 r = _mm_loadu_ps(red + i);
+			const __m128 g = _mm_loadu_ps(green + i);
+			const __m128 b = _mm_loadu_ps(blue + i);
+
+			const __m128 rgLow = _mm_unpacklo_ps(r, g);		//r0 g0 r1 g1
+			const __m128 rgHigh = _mm_unpackhi_ps(r, g);	//r2 g2 r3 g3
+			const __m128 b0r1 = _mm_shuffle_ps(b, r, _MM_SHUFFLE(1, 1, 0, 0));	//b0 b0 r1 r1
+			const __m128 g1b1 = _mm_shuffle_ps(g, b, _MM_SHUFFLE(1, 1, 1, 1));	//g1 g1 b1 b1
+			const __m128 b2r3 = _mm_shuffle_ps(b, r, _MM_SHUFFLE(3, 3, 2, 2));	//b2 b2 r3 r3
+			const __m128 g3b3 = _mm_shuffle_ps(g, b, _MM_SHUFFLE(3, 3, 3, 3));	//g3 g3 b3 b3
+
+			_mm_storeu_ps(output + 3 * i, _mm_shuffle_ps(rgLow, b0r1, _MM_SHUFFLE(2, 0, 1, 0)));		//r0 g0 b0 r1
+			_mm_storeu_ps(output + 3 * i + 4, _mm_shuffle_ps(g1b1, rgHigh, _MM_SHUFFLE(1, 0, 2, 0)));	//g1 b1 r2 g2
+			_mm_storeu_ps(output + 3 * i + 8, _mm_shuffle_ps(b2r3, g3b3, _MM_SHUFFLE(2, 0, 2, 0)));	//b2 r3 g3 b3
+		}
+#endif
+		for (; i < count; i++) {
+			destination[i] = glm::vec3(red[i], green[i], blue[i]);
+		}
+	}
+
+}
+
+//Interleaves the planes into a frame of the same size, e.g. the one the viewer lends to run().
+//The alpha plane is not part of a glm::vec3 frame and is ignored.
+inline void interleave(const PlanarFrameView& source, const FrameView& destination)
+{
+	for (int y = 0; y < source.height; y++) {
+		PixelConversion::interleaveRGB(source.redRow(y), source.greenRow(y), source.blueRow(y), destination.row(y), source.width);
+	}
+}
@@ -0,0 +1,273 @@
+#pragma once
+
+#include "Bvh.hpp"
+#include "Geometry.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RAYTRACING_OPENGLVIEWER_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define RAYTRACING_OPENGLVIEWER_AVX2
+#include <immintrin.h>
+#endif
+
+//Rays traced through the BVH together, e.g. the primary rays of a 4x2 or 4x4 block of pixels
+//or the shadow rays of their hits. Lanes without a ray are left out of every test.
+template <int Size>
+struct RayPacket
+{
+	static_assert(Size % 8 == 0 && Size <= 32, "Packets are traced in groups of eight rays");
+	static const int SIZE = Size;
+
+	Ray rays[Size];
+	Hit hits[Size];
+	//Bit per lane holding a ray
+	uint32_t activeMask = 0;
+
+	void setRay(int lane, const Ray& ray)
+	{
+		rays[lane] = ray;
+		hits[lane] = Hit();
+		activeMask |= 1u << lane;
+	}
+};
+
+//Slab tests of a whole packet against one box. intersect tests every ray, lane by lane in SIMD.
+//missesAll bounds the rays with intervals of origins and reciprocal directions and proves with a
+//handful of scalar operations that none of them can hit the box, which culls most nodes a coherent
+//packet misses without looking at its rays.
+template <int Size>
+class PacketBoxTest
+{
+public:
+	alignas(32) float inverseDirection[3][Size];
+	alignas(32) float scaledOrigin[3][Size];
+	alignas(32) float tMin[Size];
+	alignas(32) float tMax[Size];
+
+	explicit PacketBoxTest(const RayPacket<Size>& packet)
+	{
+		int negative[3] = { 0, 0, 0 };
+		int activeCount = 0;
+		for (int lane = 0; lane < Size; lane++) {
+			//Empty lanes get an interval that no box overlaps
+			for (int axis = 0; axis < 3; axis++) {
+				inverseDirection[axis][lane] = 0.0f;
+				scaledOrigin[axis][lane] = 0.0f;
+			}
+			tMin[lane] = 1.0f;
+			tMax[lane] = 0.0f;
+
+			if (packet.activeMask & (1u << lane)) {
+				const RayBoxTest boxTest(packet.rays[lane]);
+				for (int axis = 0; axis < 3; axis++) {
+					inverseDirection[axis][lane] = boxTest.inverseDirection[axis];
+					scaledOrigin[axis][lane] = boxTest.scaledOrigin[axis];
+				}
+				tMin[lane] = packet.rays[lane].tMin;
+				tMax[lane] = packet.rays[lane].tMax;
+
+				for (int axis = 0; axis < 3; axis++) {
+					const float origin = boxTest.scaledOrigin[axis];
+					const float inverse = boxTest.inverseDirection[axis];
+					scaledOriginLow[axis] = activeCount == 0 ? origin : std::min(scaledOriginLow[axis], origin);
+					scaledOriginHigh[axis] = activeCount == 0 ? origin : std::max(scaledOriginHigh[axis], origin);
+					inverseLow[axis] = activeCount == 0 ? inverse : std::min(inverseLow[axis], inverse);
+					inverseHigh[axis] = activeCount == 0 ? inverse : std::max(inverseHigh[axis], inverse);
+					negative[axis] += boxTest.directionNegative[axis];
+				}
+				tMinLow = activeCount == 0 ? tMin[lane] : std::min(tMinLow, tMin[lane]);
+				activeCount++;
+			}
+		}
+
+		//Interval culling needs all rays to leave every slab through the same plane
+		coherent = activeCount > 0;
+		for (int axis = 0; axis < 3; axis++) {
+			coherent = coherent && (negative[axis] == 0 || negative[axis] == activeCount);
+			nearPlaneIsMax[axis] = negative[axis] > 0;
+		}
+		updateIntervals(packet.activeMask);
+	}
+
+	//To be called after tMax of some rays shrank or rays were retired
+	void updateIntervals(uint32_t mask)
+	{
+		tMaxHigh = -std::numeric_limits<float>::infinity();
+		for (int lane = 0; lane < Size; lane++) {
+			if (mask & (1u << lane)) {
+				tMaxHigh = std::max(tMaxHigh, tMax[lane]);
+			}
+		}
+	}
+
+	//True if no ray of the packet can hit the box. The plane distances are bounded with the same
+	//plane * inverse + scaledOrigin as the per-ray test; that is monotonic in the inverse and the scaled
+	//origin even after rounding, so the bounds hold for every ray and entry > exit needs no padding.
+	bool missesAll(const Aabb& box) const
+	{
+		if (!coherent) {
+			return false;
+		}
+		float entry = tMinLow;
+		float exit = tMaxHigh;
+		for (int axis = 0; axis < 3; axis++) {
+			const float nearPlane = nearPlaneIsMax[axis] ? box.max[axis] : box.min[axis];
+			const float farPlane = nearPlaneIsMax[axis] ? box.min[axis] : box.max[axis];
+			entry = std::max(entry, std::min(nearPlane * inverseLow[axis] + scaledOriginLow[axis], nearPlane * inverseHigh[axis] + scaledOriginLow[axis]));
+			exit = std::min(exit, std::max(farPlane * inverseLow[axis] + scaledOriginHigh[axis], farPlane * inverseHigh[axis] + scaledOriginHigh[axis]));
+		}
+		return entry > exit;
+	}
+
+	//Bit per ray in mask whose [tMin, tMax] overlaps the box, the same test as RayBoxTest per lane
+	uint32_t intersect(const Aabb& box, uint32_t mask) const
+	{
+		uint32_t hits = 0;
+#if defined(RAYTRACING_OPENGLVIEWER_AVX2)
+		for (int group = 0; group < Size; group += 8) {
+			if (((mask >> group) & 0xffu) == 0) {
+				continue;
+			}
+			__m256 entry = _mm256_load_ps(tMin + group);
+			__m256 exit = _mm256_load_ps(tMax + group);
+			for (int axis = 0; axis < 3; axis++) {
+				const __m256 inverse = _mm256_load_ps(inverseDirection[axis] + group);
+				const __m256 origin = _mm256_load_ps(scaledOrigin[axis] + group);
+				const __m256 t0 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(box.min[axis]), inverse), origin);
+				const __m256 t1 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(box.max[axis]), inverse), origin);
+				entry = _mm256_max_ps(entry, _mm256_min_ps(t0, t1));
+				exit = _mm256_min_ps(exit, _mm256_max_ps(t0, t1));
+			}
+			hits |= static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ))) << group;
+		}
+#elif defined(RAYTRACING_OPENGLVIEWER_SSE2)
+		for (int group = 0; group < Size; group += 4) {
+			if (((mask >> group) & 0xfu) == 0) {
+				continue;
+			}
+			__m128 entry = _mm_load_ps(tMin + group);
+			__m128 exit = _mm_load_ps(tMax + group);
+			for (int axis = 0; axis < 3; axis++) {
+				const __m128 inverse = _mm_load_ps(inverseDirection[axis] + group);
+				const __m128 origin = _mm_load_ps(scaledOrigin[axis] + group);
+				const __m128 t0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(box.min[axis]), inverse), origin);
+				const __m128 t1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(box.max[axis]), inverse), origin);
+				entry = _mm_max_ps(entry, _mm_min_ps(t0, t1));
+				exit = _mm_min_ps(exit, _mm_max_ps(t0, t1));
+			}
+			hits |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(entry, exit))) << group;
+		}
+#else
+		for (int lane = 0; lane < Size; lane++) {
+			float entry = tMin[lane];
+			float exit = tMax[lane];
+			for (int axis = 0; axis < 3; axis++) {
+				const float t0 = box.min[axis] * inverseDirection[axis][lane] + scaledOrigin[axis][lane];
+				const float t1 = box.max[axis] * inverseDirection[axis][lane] + scaledOrigin[axis][lane];
+				entry = std::max(entry, std::min(t0, t1));
+				exit = std::min(exit, std::max(t0, t1));
+			}
+			hits |= (entry <= exit ? 1u : 0u) << lane;
+		}
+#endif
+		return hits & mask;
+	}
+
+private:
+	bool coherent = false;
+	int nearPlaneIsMax[3] = { 0, 0, 0 };
+	float scaledOriginLow[3] = { 0.0f, 0.0f, 0.0f };
+	float scaledOriginHigh[3] = { 0.0f, 0.0f, 0.0f };
+	float inverseLow[3] = { 0.0f, 0.0f, 0.0f };
+	float inverseHigh[3] = { 0.0f, 0.0f, 0.0f };
+	float tMinLow = 0.0f;
+	float tMaxHigh = 0.0f;
+};
+
+//Traverses the binary BVH once for the whole packet. Every node is first culled by intervals, then
+//tested against the rays still active; triangles are only tested for the rays that reached their leaf.
+//Returns a bit per ray with a hit, for AnyHit rays are retired at their first hit.
+template <bool AnyHit, int Size>
+uint32_t traversePacket(const Bvh& bvh, RayPacket<Size>& packet)
+{
+	const std::vector<BvhNode>& nodes = bvh.getNodes();
+	const std::vector<PrecomputedTriangle>& triangles = bvh.getTriangles();
+	if (nodes.empty() || packet.activeMask == 0) {
+		return 0;
+	}
+
+	PacketBoxTest<Size> boxTest(packet);
+	//Children are visited in the order of their centers along the summed directions
+	glm::vec3 direction(0.0f);
+	for (int lane = 0; lane < Size; lane++) {
+		if (packet.activeMask & (1u << lane)) {
+			direction += packet.rays[lane].direction;
+		}
+	}
+
+	uint32_t active = packet.activeMask;
+	uint32_t found = 0;
+	uint32_t stack[Bvh::MAX_DEPTH];
+	int stackSize = 0;
+	uint32_t current = 0;
+	while (true) {
+		const BvhNode& node = nodes[current];
+		const uint32_t mask = boxTest.missesAll(node.bounds) ? 0 : boxTest.intersect(node.bounds, active);
+		if (mask != 0) {
+			if (node.isLeaf()) {
+				for (uint32_t i = node.index; i < node.index + node.count; i++) {
+					for (int lane = 0; lane < Size; lane++) {
+						if ((mask & active & (1u << lane)) && intersectTriangle(packet.rays[lane], triangles[i], packet.hits[lane])) {
+							found |= 1u << lane;
+							boxTest.tMax[lane] = packet.rays[lane].tMax;
+							if (AnyHit) {
+								active &= ~(1u << lane);
+							}
+						}
+					}
+				}
+				if (AnyHit && active == 0) {
+					return found;
+				}
+				boxTest.updateIntervals(active);
+			}
+			else {
+				const float distance0 = glm::dot(nodes[node.index].bounds.getCenter(), direction);
+				const float distance1 = glm::dot(nodes[node.index + 1].bounds.getCenter(), direction);
+				const uint32_t first = distance1 < distance0 ? 1 : 0;
+				stack[stackSize++] = node.index + 1 - first;
+				current = node.index + first;
+				continue;
+			}
+		}
+
+		if (stackSize == 0) {
+			return found;
+		}
+		current = stack[--stackSize];
+	}
+}
+
+//Closest hits of all rays of the packet, returns a bit per ray that hit something
+template <int Size>
+uint32_t intersectPacket(const Bvh& bvh, RayPacket<Size>& packet)
+{
+	return traversePacket<false>(bvh, packet);
+}
+
+//Bit per ray that hits anything within its [tMin, tMax], e.g. for shadow rays
+template <int Size>
+uint32_t occludedPacket(const Bvh& bvh, const RayPacket<Size>& packet)
+{
+	RayPacket<Size> shortened = packet;
+	return traversePacket<true>(bvh, shortened);
+}
@@ -11,17 +11,43 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "GLContext.hpp"
+#include "PixelBufferRing.hpp"
+#include "FrameBuffer.hpp"
+#include "PlanarFrameBuffer.hpp"
+#include "TripleBuffer.hpp"
+#include "PixelFormats.hpp"
+#include "ImageWriter.hpp"
+#include "FrameStatistics.hpp"
+#include "GpuTimer.hpp"
+#include "TraceRecorder.hpp"
+#include "FrameArena.hpp"
+
 #include <random>
 #include <chrono>
 #include <thread>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
 
 const char *vertexShaderSource = "#version 330 core\n"
 "layout (location = 0) in vec3 aPos;\n"
 "out vec2 xyPosition;\n"
+"//Fraction of the viewport covered by the image along each axis, keeps its aspect ratio\n"
+"uniform vec2 imageScale;\n"
 "void main()\n"
 "{\n"
 "   gl_Position = vec4(aPos, 1.0);\n"
-" xyPosition = vec2((aPos.x + 1.0)/2.0, (aPos.y + 1.0)/2.0);\n"
+"//Texture row 0 holds the top row of the image, so t runs from the top of the quad downwards\n"
+" xyPosition = vec2((aPos.x / imageScale.x + 1.0)/2.0, (1.0 - aPos.y / imageScale.y)/2.0);\n"
 "//vertexColor = vec4(1.0 - (aPos.x + 1.0)/2.0,1.0 - (aPos.y + 1.0)/2.0, 0.0, 1.0);\n"
 "}\0";
 const char *fragmentShaderSource = "#version 330 core\n"
@@ -31,7 +57,9 @@ const char *fragmentShaderSource = "#version 330 core\n"
 "void main()\n"
 "{\n"
 "//if(xyPosition.x < 0.6 && xyPosition.x > 0.4)\n"
-"   FragColor = texture(ourTexture, xyPosition);\n"
+"   vec4 texel = texture(ourTexture, xyPosition);\n"
+"//Accumulated images store the sum of the samples in rgb and their count in alpha, plain images have an alpha of 1\n"
+"   FragColor = vec4(texel.rgb / max(texel.a, 1.0), 1.0);\n"
 "}\n\0";
 
 class Shader
@@ -104,6 +132,14 @@ public:
 
 
 
+//Window shows frames on screen. Hidden renders the same way into an invisible window (falling back to GLFW's null
+//platform with an OSMesa context when available and there is no display). Null creates no window and no GL context at all.
+enum class ViewerBackend {
+	Window,
+	Hidden,
+	Null
+};
+
 class RayTracingOpenGLViewer {
 
     static RayTracingOpenGLViewer *s_instance;
@@ -118,16 +154,230 @@ public:
         return s_instance;
     }
 
-    void run(std::function<std::vector<glm::vec3>()> createImage = nullptr) {
+    //renderFrame writes each frame straight into a buffer owned by the viewer,
+    //so producing a frame needs no allocation and no extra copy.
+    //It is called repeatedly on a dedicated render thread, the window stays responsive however long it takes.
+    void run(std::function<void(FrameView&)> renderFrame = nullptr) {
+        //A previous run may have stopped after maxFrames or through stop()
+        stopRequested = false;
+        deliveredFrames = 0;
+        TraceRecorder::getInstance().setThreadName("display");
         initWindow();
-        mainLoop(createImage);
+        try {
+            startRenderThread(renderFrame);
+            if (backend == ViewerBackend::Null) {
+                headlessLoop();
+            }
+            else {
+                mainLoop();
+            }
+        }
+        catch (...) {
+            //E.g. the frame sink or an upload failed. The render thread must not outlive run(),
+            //the caller may destroy whatever renderFrame uses as soon as the exception arrives.
+            abortRenderThread();
+            cleanup();
+            throw;
+        }
+        stopRenderThread();
         cleanup();
+        exportStatistics();
+    }
+
+    //Compatibility path for producers returning a whole image, costs one copy per frame
+    void runImage(std::function<std::vector<glm::vec3>()> createImage) {
+        if (createImage == nullptr) {
+            run();
+            return;
+        }
+        run([this, createImage](FrameView& frame) {
+            const std::vector<glm::vec3> image = createImage();
+            ScopedStageTimer timer(statistics, FrameStage::SetImage);
+            copyImage(image, frame);
+        });
     }
 
-	void setImage(const std::vector<glm::vec3> pixels)
+    //Producers writing one plane per channel, e.g. with full-width SIMD stores.
+    //The planes belong to the render thread and are interleaved into the viewer's frame after each call.
+    void runPlanar(std::function<void(PlanarFrameView&)> renderPlanarFrame) {
+        if (renderPlanarFrame == nullptr) {
+            run();
+            return;
+        }
+        std::shared_ptr<PlanarFrameBuffer> planes = std::make_shared<PlanarFrameBuffer>();
+        run([this, renderPlanarFrame, planes](FrameView& frame) {
+            planes->resize(frame.width, frame.height);
+            PlanarFrameView planarFrame = planes->view();
+            renderPlanarFrame(planarFrame);
+            ScopedStageTimer timer(statistics, FrameStage::SetImage);
+            interleave(planarFrame, frame);
+        });
+    }
+
+	//Publishes a row-major image of the current image size when frames are pushed
+	//from a single outside thread instead of being produced through run(renderFrame)
+	void setImage(const std::vector<glm::vec3>& pixels)
+	{
+		int width;
+		int height;
+		getImageSize(width, height);
+		FrameBuffer& backFrame = frames.back();
+		backFrame.resize(width, height);
+		FrameView frame = backFrame.view();
+		{
+			ScopedStageTimer timer(statistics, FrameStage::SetImage);
+			copyImage(pixels, frame);
+		}
+		publishFrame(frame);
+	}
+
+	//Size of the frames handed to the renderer. Callable at any time, the next frame gets the new size
+	//and the texture is only reallocated once a frame of a different size is displayed.
+	void setImageSize(int width, int height)
+	{
+		if (width <= 0 || height <= 0) {
+			throw std::runtime_error("Image size must be positive");
+		}
+		imageSize = packImageSize(width, height);
+	}
+
+	//In progressive accumulation mode every new frame is treated as one more sample per pixel
+	//and the mean of all samples since the last reset is displayed
+	void setAccumulation(bool enabled)
+	{
+		accumulationEnabled = enabled;
+		resetAccumulation();
+	}
+
+	//Format frames are converted to before they are uploaded, e.g. RGBA16F or RGB9_E5 to cut the upload size of big frames.
+	//Callable at any time, the texture is reallocated with the next frame.
+	void setUploadFormat(UploadFormat format)
+	{
+		uploadFormat = format;
+	}
+
+	//Discards all accumulated samples, e.g. after the camera or the scene changed. Callable from any thread.
+	void resetAccumulation()
+	{
+		accumulationResetRequested = true;
+	}
+
+	//Queues a finished bucket of width x height pixels whose top-left corner is at (x, y), rows are stride
+	//pixels apart (0 means tightly packed). Only the regions covered by tiles are uploaded, once per displayed frame.
+	//Callable from any thread, the pixels are copied before returning.
+	void submitTile(int x, int y, int width, int height, const glm::vec3* pixels, int stride = 0)
+	{
+		if (stride == 0) {
+			stride = width;
+		}
+		if (stride < width) {
+			throw std::runtime_error("Tile stride must be at least the tile width");
+		}
+
+		//Clip the tile against the image
+		int currentWidth;
+		int currentHeight;
+		getImageSize(currentWidth, currentHeight);
+		const int x0 = std::max(x, 0);
+		const int y0 = std::max(y, 0);
+		const int x1 = std::min(x + width, currentWidth);
+		const int y1 = std::min(y + height, currentHeight);
+		if (x0 >= x1 || y0 >= y1) {
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(tileMutex);
+			PendingTile tile;
+			tile.region = ImageRegion(x0, y0, x1 - x0, y1 - y0);
+			tile.offset = pendingTilePixels.size();
+			for (int row = y0; row < y1; row++) {
+				const glm::vec3* source = pixels + static_cast<size_t>(row - y) * stride + (x0 - x);
+				pendingTilePixels.insert(pendingTilePixels.end(), source, source + tile.region.width);
+			}
+			pendingTiles.push_back(tile);
+			tilesPending = true;
+		}
+		wakeDisplay();
+	}
+
+	//Swap interval used when presenting, on by default. Callable at any time.
+	void setVSync(bool enabled)
+	{
+		vsyncEnabled = enabled;
+		swapIntervalChanged = true;
+		wakeDisplay();
+	}
+
+	//Upper bound on how often new frames are presented, 0 presents every new frame as soon as it arrives
+	void setTargetFrameRate(double framesPerSecond)
+	{
+		targetFrameInterval = framesPerSecond > 0.0 ? 1.0 / framesPerSecond : 0.0;
+	}
+
+	//Where frames are shown, set before run(). The hidden and null backends need no display,
+	//so the same producer loop can run on render farm nodes and in CI.
+	void setBackend(ViewerBackend newBackend)
+	{
+		backend = newBackend;
+	}
+
+	//Called on the display thread with every image that is displayed (the resolved mean when accumulating),
+	//e.g. to write frames to disk with writePFM or keep them in memory. The view is only valid during the call.
+	void setFrameSink(std::function<void(const FrameView&)> sink)
+	{
+		frameSink = sink;
+	}
+
+	//run() returns after this many frames were displayed, 0 runs until the window is closed or stop() is called
+	void setMaxFrames(int frameCount)
+	{
+		maxFrames = frameCount;
+	}
+
+	//Rolling timings of the last frames for one stage, e.g. FrameStage::Upload. Callable from any thread.
+	StageStatistics getStageStatistics(FrameStage stage)
+	{
+		return statistics.getStatistics(stage);
+	}
+
+	FrameStatistics& getStatistics()
+	{
+		return statistics;
+	}
+
+	//The per-stage statistics are printed when run() returns, and also written to this file as JSON if it is set
+	void setStatisticsFile(const std::string& path)
+	{
+		statisticsFile = path;
+	}
+
+	//Records a timeline of the render thread and the display loop, written to this file in the
+	//Chrome trace event format when run() returns. Open it in chrome://tracing or ui.perfetto.dev.
+	void setTraceFile(const std::string& path)
+	{
+		traceFile = path;
+		TraceRecorder::getInstance().setEnabled(!path.empty());
+	}
+
+	//Scratch memory for the calling thread while it produces a frame, e.g. from renderFrame or the
+	//tile kernels it runs. Everything allocated is reclaimed before the next call to renderFrame.
+	FrameArena& getFrameArena()
+	{
+		return frameArenas.local();
+	}
+
+	//Bytes the frame arenas handed out while producing the last frame
+	size_t getFrameArenaBytes() const
 	{
-		inputPixels.clear();
-		inputPixels = std::move(pixels);
+		return frameArenas.getBytesLastFrame();
+	}
+
+	//Makes run() return, callable from any thread
+	void stop()
+	{
+		stopRequested = true;
+		wakeDisplay();
 	}
 
 private:
@@ -145,11 +395,108 @@ private:
 
 	Shader ourShader;
 	unsigned int texture;
-	std::vector<glm::vec3> inputPixels;
+	//Frames travel from the render thread to the display loop through a lock-free triple buffer, latest wins
+	TripleBuffer<FrameBuffer> frames;
+	std::thread renderThread;
+	std::atomic<bool> renderThreadRunning{ false };
+	std::atomic<bool> renderThreadFailed{ false };
+	std::exception_ptr renderThreadException;
     const int WIDTH = 1280;
     const int HEIGHT = 720;
 	unsigned int VBO, VAO;
 
+	//Size of the produced frames, width in the high and height in the low 32 bits so readers on other
+	//threads never see the width of one size with the height of another, and of the storage currently
+	//allocated for the texture
+	std::atomic<uint64_t> imageSize{ packImageSize(WIDTH, HEIGHT) };
+	int textureWidth = 0;
+	int textureHeight = 0;
+	int viewWidth = 0;
+	int viewHeight = 0;
+
+	//Progressive accumulation: running sum of the samples in rgb and per-pixel sample count in alpha,
+	//uploaded as it is and divided by the fragment shader
+	struct AccumulationBuffer {
+		AlignedVector<glm::vec4> pixels;
+		int width = 0;
+		int height = 0;
+		//Pixel samples summed since the last reset
+		uint64_t samples = 0;
+	};
+	std::atomic<bool> accumulationEnabled{ false };
+	std::atomic<bool> accumulationResetRequested{ false };
+	//The running sum belongs to the producer side: the render thread (or the thread calling setImage) sums
+	//every frame and publishes a copy, so none are lost to the latest-wins triple buffer. Without frames
+	//the display loop sums the tiles as they are drained. Frames and tiles are not summed together.
+	AccumulationBuffer accumulation;
+	TripleBuffer<AccumulationBuffer> accumulatedFrames;
+	//Samples of the accumulated image on screen, for the title
+	uint64_t displayedSamples = 0;
+	//Whether the tiles drained last went to the running sum
+	bool tilesAccumulated = false;
+	GLenum textureInternalFormat = GL_RGB32F;
+
+	//Tiles submitted since the last displayed frame, their pixels are packed one after the other
+	struct PendingTile {
+		ImageRegion region;
+		size_t offset;
+	};
+	std::mutex tileMutex;
+	std::atomic<bool> tilesPending{ false };
+	std::vector<PendingTile> pendingTiles;
+	std::vector<glm::vec3> pendingTilePixels;
+	//Swapped with the pending queue by the display loop so the capacity is reused
+	std::vector<PendingTile> drainedTiles;
+	std::vector<glm::vec3> drainedTilePixels;
+	//Image the tiles are written to when not accumulating, and the regions to upload this frame
+	FrameBuffer tileImage;
+	std::vector<ImageRegion> dirtyRegions;
+	std::vector<ImageRegion> wholeImage;
+
+	//Frames are converted to this format before they are uploaded, accumulated images always go up as RGBA32F
+	std::atomic<UploadFormat> uploadFormat{ UploadFormat::RGB32F };
+	const PixelFormatInfo ACCUMULATION_FORMAT = { GL_RGBA32F, GL_RGBA, GL_FLOAT, sizeof(glm::vec4), "RGBA32F" };
+	//Used instead of a pixel buffer when one cannot be mapped
+	std::vector<char> stagingPixels;
+
+	//Frames are streamed to the texture through a ring of pixel unpack buffers
+	PixelBufferRing pixelBuffers;
+	const int PIXEL_BUFFER_COUNT = 3;
+
+	//Backend, and the consumer side used to deliver displayed frames without a window
+	ViewerBackend backend = ViewerBackend::Window;
+	std::function<void(const FrameView&)> frameSink;
+	FrameBuffer resolvedImage;
+	std::atomic<int> maxFrames{ 0 };
+	int deliveredFrames = 0;
+	std::atomic<bool> stopRequested{ false };
+	std::mutex wakeMutex;
+	std::condition_variable wakeCondition;
+
+	//Frame pacing: the display loop sleeps in glfwWaitEvents until a new frame, a tile or a redraw is due,
+	//producers wake it with glfwPostEmptyEvent while it is waiting
+	std::atomic<bool> displayWaiting{ false };
+	std::atomic<bool> redrawRequested{ true };
+	std::atomic<bool> vsyncEnabled{ true };
+	std::atomic<bool> swapIntervalChanged{ true };
+	std::atomic<double> targetFrameInterval{ 0.0 };
+	std::chrono::high_resolution_clock::time_point lastPresentTime;
+
+	//Per-stage timings, recorded by the render thread and the display loop, plus GPU timings read back asynchronously
+	FrameStatistics statistics;
+	GpuTimerPool gpuTimers;
+	const int GPU_TIMER_QUERY_COUNT = 8;
+	std::string statisticsFile;
+	std::string traceFile;
+
+	//Per-thread scratch memory of the producer, reset between two calls to renderFrame
+	FrameArenas frameArenas;
+
+	//Frame-time counter, averaged and reported in the window title about once per second
+	std::chrono::high_resolution_clock::time_point lastFrameTimeReport;
+	double accumulatedFrameTime = 0.0;
+	int timedFrames = 0;
+
     GLFWwindow* window{};
     
     void createBaseTriangleAndTexture() {
@@ -187,10 +534,462 @@ private:
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		
+
+		//Allocate the texture storage once, per-frame updates only replace its contents
+		int imageWidth;
+		int imageHeight;
+		getImageSize(imageWidth, imageHeight);
+		allocateTexture(imageWidth, imageHeight, GL_RGB32F);
+
+		int framebufferWidth, framebufferHeight;
+		glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+		resizeView(framebufferWidth, framebufferHeight);
+		pixelBuffers.create(PIXEL_BUFFER_COUNT, frames.front().sizeInBytes());
+		gpuTimers.create(GPU_TIMER_QUERY_COUNT);
 
     }
 
+	void allocateTexture(int width, int height, GLenum internalFormat) {
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+		textureWidth = width;
+		textureHeight = height;
+		textureInternalFormat = internalFormat;
+	}
+
+	static void copyImage(const std::vector<glm::vec3>& pixels, FrameView& frame) {
+		if (pixels.size() != static_cast<size_t>(frame.width) * frame.height) {
+			std::ostringstream message;
+			message << "Image has " << pixels.size() << " pixels, expected " << frame.width << "x" << frame.height;
+			throw std::runtime_error(message.str());
+		}
+
+		for (int y = 0; y < frame.height; y++) {
+			const size_t rowStart = static_cast<size_t>(y) * frame.width;
+			std::copy(pixels.begin() + rowStart, pixels.begin() + rowStart + frame.width, frame.row(y));
+		}
+	}
+
+	static uint64_t packImageSize(int width, int height) {
+		return (static_cast<uint64_t>(static_cast<uint32_t>(width)) << 32) | static_cast<uint32_t>(height);
+	}
+
+	//Reads both dimensions of the image size from the same setImageSize call
+	void getImageSize(int& width, int& height) const {
+		const uint64_t size = imageSize;
+		width = static_cast<int>(size >> 32);
+		height = static_cast<int>(size & 0xffffffffu);
+	}
+
+	void startRenderThread(std::function<void(FrameView&)> renderFrame) {
+		if (renderFrame == nullptr) {
+			return;
+		}
+
+		renderThreadRunning = true;
+		renderThread = std::thread([this, renderFrame]() {
+			TraceRecorder::getInstance().setThreadName("render");
+			try {
+				while (renderThreadRunning) {
+					FrameBuffer& backFrame = frames.back();
+					int width;
+					int height;
+					getImageSize(width, height);
+					backFrame.resize(width, height);
+					FrameView frame = backFrame.view();
+					frameArenas.reset();
+					{
+						ScopedStageTimer timer(statistics, FrameStage::Render);
+						renderFrame(frame);
+					}
+					publishFrame(frame);
+				}
+			}
+			catch (...) {
+				//Handed over to the display loop, which closes the window and rethrows it
+				renderThreadException = std::current_exception();
+				renderThreadFailed = true;
+				wakeDisplay();
+			}
+		});
+	}
+
+	//Joins the render thread and drops its exception, for when the display thread is already failing
+	void abortRenderThread() {
+		renderThreadRunning = false;
+		if (renderThread.joinable()) {
+			renderThread.join();
+		}
+		renderThreadException = nullptr;
+	}
+
+	void stopRenderThread() {
+		renderThreadRunning = false;
+		if (renderThread.joinable()) {
+			renderThread.join();
+		}
+		if (renderThreadException) {
+			std::exception_ptr exception = renderThreadException;
+			renderThreadException = nullptr;
+			cleanup();
+			std::rethrow_exception(exception);
+		}
+	}
+
+	//Only reallocates the texture storage when the image size or format changes, returns true if it did
+	bool ensureTexture(int width, int height, GLenum internalFormat) {
+		if (width != textureWidth || height != textureHeight || internalFormat != textureInternalFormat) {
+			allocateTexture(width, height, internalFormat);
+			return true;
+		}
+		return false;
+	}
+
+	void uploadImage(const FrameBuffer& inputFrame) {
+		const UploadFormat format = uploadFormat;
+		const PixelFormatInfo target = getPixelFormatInfo(format);
+		ensureTexture(inputFrame.getWidth(), inputFrame.getHeight(), target.internalFormat);
+
+		wholeImage.assign(1, ImageRegion(0, 0, inputFrame.getWidth(), inputFrame.getHeight()));
+		uploadRegions(target, wholeImage, [&inputFrame, format](void* destination, int x, int y, int count) {
+			convertPixels(format, inputFrame.data() + static_cast<size_t>(y) * inputFrame.getStride() + x, destination, count);
+		});
+	}
+
+	//Producer side: hands a finished frame to the display loop, or when accumulating adds it to the running sum
+	//and publishes a copy of the sum instead
+	void publishFrame(const FrameView& frame) {
+		if (!accumulationEnabled) {
+			frames.publish();
+			wakeDisplay();
+			return;
+		}
+
+		{
+			ScopedStageTimer timer(statistics, FrameStage::Accumulate);
+			prepareAccumulation(frame.width, frame.height);
+			AccumulationBuffer& published = accumulatedFrames.back();
+			published.pixels.resize(accumulation.pixels.size());
+			for (int y = 0; y < frame.height; y++) {
+				const glm::vec3* row = frame.row(y);
+				glm::vec4* sum = accumulation.pixels.data() + static_cast<size_t>(y) * frame.width;
+				glm::vec4* copy = published.pixels.data() + static_cast<size_t>(y) * frame.width;
+				for (int x = 0; x < frame.width; x++) {
+					sum[x] += glm::vec4(row[x], 1.0f);
+					copy[x] = sum[x];
+				}
+			}
+			accumulation.samples += static_cast<uint64_t>(frame.width) * frame.height;
+			published.width = accumulation.width;
+			published.height = accumulation.height;
+			published.samples = accumulation.samples;
+		}
+		accumulatedFrames.publish();
+		wakeDisplay();
+	}
+
+	//Restarts the running sum if a reset was requested or the size changed, returns true if it did
+	bool prepareAccumulation(int width, int height) {
+		if (accumulationResetRequested.exchange(false) || width != accumulation.width || height != accumulation.height) {
+			accumulation.pixels.assign(static_cast<size_t>(width) * height, glm::vec4(0.0f));
+			accumulation.width = width;
+			accumulation.height = height;
+			accumulation.samples = 0;
+			return true;
+		}
+		return false;
+	}
+
+	//Divides the running sum by the sample counts, only needed when the mean is not resolved by the fragment shader
+	FrameBuffer& resolveAccumulation(const AccumulationBuffer& sums) {
+		resolvedImage.resize(sums.width, sums.height);
+		for (int y = 0; y < sums.height; y++) {
+			const glm::vec4* sum = sums.pixels.data() + static_cast<size_t>(y) * sums.width;
+			glm::vec3* row = resolvedImage.data() + static_cast<size_t>(y) * resolvedImage.getStride();
+			for (int x = 0; x < sums.width; x++) {
+				row[x] = glm::vec3(sum[x].x, sum[x].y, sum[x].z) / std::max(sum[x].w, 1.0f);
+			}
+		}
+		return resolvedImage;
+	}
+
+	void uploadAccumulation(const AccumulationBuffer& sums, const std::vector<ImageRegion>& regions) {
+		const int width = sums.width;
+		uploadRegions(ACCUMULATION_FORMAT, regions, [&sums, width](void* destination, int x, int y, int count) {
+			std::memcpy(destination, sums.pixels.data() + static_cast<size_t>(y) * width + x, count * sizeof(glm::vec4));
+		});
+		displayedSamples = sums.samples;
+	}
+
+	//Uploads a sum published by the producer side as a whole
+	void uploadAccumulatedFrame(const AccumulationBuffer& sums) {
+		ensureTexture(sums.width, sums.height, ACCUMULATION_FORMAT.internalFormat);
+		wholeImage.assign(1, ImageRegion(0, 0, sums.width, sums.height));
+		uploadAccumulation(sums, wholeImage);
+	}
+
+	//Writes the queued tiles into the tile image or the running sum and collects the regions they cover in dirtyRegions.
+	//Returns false if no tile fit into the image; wholeImageChanged is set if the running sum was restarted.
+	bool drainTiles(bool& wholeImageChanged) {
+		{
+			std::lock_guard<std::mutex> lock(tileMutex);
+			if (pendingTiles.empty()) {
+				return false;
+			}
+			std::swap(pendingTiles, drainedTiles);
+			std::swap(pendingTilePixels, drainedTilePixels);
+			tilesPending = false;
+		}
+
+		//While the render thread sums frames it owns the running sum, tiles are then shown as they are
+		const bool accumulate = accumulationEnabled && !renderThreadRunning;
+		int width;
+		int height;
+		getImageSize(width, height);
+		dirtyRegions.clear();
+
+		wholeImageChanged = false;
+		if (accumulate) {
+			wholeImageChanged = prepareAccumulation(width, height);
+		}
+		else {
+			tileImage.resize(width, height);
+		}
+
+		for (const PendingTile& tile : drainedTiles) {
+			const ImageRegion& region = tile.region;
+			if (region.x + region.width > width || region.y + region.height > height) {
+				continue;
+			}
+
+			const glm::vec3* source = drainedTilePixels.data() + tile.offset;
+			for (int y = region.y; y < region.y + region.height; y++, source += region.width) {
+				if (accumulate) {
+					glm::vec4* sum = accumulation.pixels.data() + static_cast<size_t>(y) * width + region.x;
+					for (int x = 0; x < region.width; x++) {
+						sum[x] += glm::vec4(source[x], 1.0f);
+					}
+				}
+				else {
+					std::copy(source, source + region.width, tileImage.data() + static_cast<size_t>(y) * tileImage.getStride() + region.x);
+				}
+			}
+			if (accumulate) {
+				accumulation.samples += static_cast<uint64_t>(region.width) * region.height;
+			}
+			dirtyRegions.push_back(region);
+		}
+		tilesAccumulated = accumulate;
+		drainedTiles.clear();
+		drainedTilePixels.clear();
+		//Tiles queued before the image shrank are dropped, there is nothing to upload then
+		return !dirtyRegions.empty();
+	}
+
+	//Uploads the regions collected by drainTiles
+	void uploadTiles(bool uploadWholeImage) {
+		const bool accumulate = tilesAccumulated;
+		const int width = accumulate ? accumulation.width : tileImage.getWidth();
+		const int height = accumulate ? accumulation.height : tileImage.getHeight();
+		const UploadFormat format = uploadFormat;
+		const GLenum internalFormat = accumulate ? ACCUMULATION_FORMAT.internalFormat : getPixelFormatInfo(format).internalFormat;
+
+		//A new texture has undefined contents, so everything has to go up once
+		if (ensureTexture(width, height, internalFormat)) {
+			uploadWholeImage = true;
+		}
+		if (uploadWholeImage) {
+			dirtyRegions.assign(1, ImageRegion(0, 0, width, height));
+		}
+		coalesceRegions(dirtyRegions);
+
+		if (accumulate) {
+			uploadAccumulation(accumulation, dirtyRegions);
+		}
+		else {
+			uploadRegions(getPixelFormatInfo(format), dirtyRegions, [this, format](void* destination, int x, int y, int count) {
+				convertPixels(format, tileImage.data() + static_cast<size_t>(y) * tileImage.getStride() + x, destination, count);
+			});
+		}
+	}
+
+	//Hands the image that is now displayed to the frame sink and stops once the requested number of frames was shown.
+	//getImage is only called if there is a sink.
+	template <typename GetImage>
+	void deliverImage(const GetImage& getImage) {
+		deliveredFrames++;
+		if (frameSink != nullptr) {
+			FrameView frame = getImage();
+			frameSink(frame);
+		}
+		if (maxFrames > 0 && deliveredFrames >= maxFrames) {
+			stopRequested = true;
+		}
+	}
+
+	void deliverFrame(FrameBuffer& displayedImage) {
+		deliverImage([&displayedImage]() { return displayedImage.view(); });
+	}
+
+	//The frame sink gets the mean of an accumulated image
+	void deliverAccumulation(const AccumulationBuffer& sums) {
+		deliverImage([this, &sums]() { return resolveAccumulation(sums).view(); });
+	}
+
+	//Merges regions of the same rows that touch horizontally, then regions of the same columns that touch vertically,
+	//so a row of finished buckets becomes a single upload
+	static void coalesceRegions(std::vector<ImageRegion>& regions) {
+		if (regions.size() < 2) {
+			return;
+		}
+
+		std::sort(regions.begin(), regions.end(), [](const ImageRegion& a, const ImageRegion& b) {
+			return a.y != b.y ? a.y < b.y : (a.height != b.height ? a.height < b.height : a.x < b.x);
+		});
+		size_t merged = 0;
+		for (size_t i = 1; i < regions.size(); i++) {
+			ImageRegion& last = regions[merged];
+			const ImageRegion& next = regions[i];
+			if (next.y == last.y && next.height == last.height && next.x <= last.x + last.width) {
+				last.width = std::max(last.width, next.x + next.width - last.x);
+			}
+			else {
+				regions[++merged] = next;
+			}
+		}
+		regions.resize(merged + 1);
+
+		std::sort(regions.begin(), regions.end(), [](const ImageRegion& a, const ImageRegion& b) {
+			return a.x != b.x ? a.x < b.x : (a.width != b.width ? a.width < b.width : a.y < b.y);
+		});
+		merged = 0;
+		for (size_t i = 1; i < regions.size(); i++) {
+			ImageRegion& last = regions[merged];
+			const ImageRegion& next = regions[i];
+			if (next.x == last.x && next.width == last.width && next.y <= last.y + last.height) {
+				last.height = std::max(last.height, next.y + next.height - last.y);
+			}
+			else {
+				regions[++merged] = next;
+			}
+		}
+		regions.resize(merged + 1);
+	}
+
+	//Packs the regions into the next pixel buffer of the ring and uploads each of them; the GPU may still be reading
+	//the previous buffer. convertRow(destination, x, y, count) writes count pixels of row y from column x in the target format.
+	template <typename ConvertRow>
+	void uploadRegions(const PixelFormatInfo& target, const std::vector<ImageRegion>& regions, ConvertRow convertRow) {
+		size_t sizeInBytes = 0;
+		for (const ImageRegion& region : regions) {
+			sizeInBytes += static_cast<size_t>(region.width) * region.height * target.pixelSize;
+		}
+
+		glBindTexture(GL_TEXTURE_2D, texture);
+
+		char* packedPixels = static_cast<char*>(pixelBuffers.map(sizeInBytes));
+		const bool mapped = packedPixels != nullptr;
+		if (!mapped) {
+			//Fall back to synchronous uploads from client memory
+			pixelBuffers.unbind();
+			stagingPixels.resize(sizeInBytes);
+			packedPixels = stagingPixels.data();
+		}
+
+		size_t offset = 0;
+		for (const ImageRegion& region : regions) {
+			const size_t regionRowSize = region.width * target.pixelSize;
+			for (int y = region.y; y < region.y + region.height; y++) {
+				convertRow(packedPixels + offset, region.x, y, region.width);
+				offset += regionRowSize;
+			}
+		}
+
+		if (mapped && !pixelBuffers.unmap()) {
+			pixelBuffers.unbind();
+			return;
+		}
+
+		offset = 0;
+		for (const ImageRegion& region : regions) {
+			//Offset into the bound pixel buffer, or pointer into the staging copy
+			const void* data = mapped ? reinterpret_cast<const void*>(offset) : stagingPixels.data() + offset;
+			glTexSubImage2D(GL_TEXTURE_2D, 0, region.x, region.y, region.width, region.height, target.format, target.type, data);
+			offset += static_cast<size_t>(region.width) * region.height * target.pixelSize;
+		}
+
+		if (mapped) {
+			pixelBuffers.fence();
+			pixelBuffers.unbind();
+		}
+	}
+
+	//Wakes the display loop if it is sleeping, callable from any thread
+	void wakeDisplay() {
+		if (backend == ViewerBackend::Null) {
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			wakeCondition.notify_all();
+		}
+		else if (displayWaiting.exchange(false)) {
+			glfwPostEmptyEvent();
+		}
+	}
+
+	bool hasWork() const {
+		return frames.hasNewValue() || accumulatedFrames.hasNewValue() || tilesPending || redrawRequested || renderThreadFailed;
+	}
+
+	//Processes window events and returns true once something has to be presented. Sleeps while there is nothing
+	//new to show, and until the next present time when a target frame rate is set.
+	bool waitForWork() {
+		displayWaiting = true;
+		if (!hasWork()) {
+			ScopedStageTimer timer(statistics, FrameStage::Wait);
+			glfwWaitEvents();
+			displayWaiting = false;
+			return false;
+		}
+
+		const double interval = targetFrameInterval;
+		if (interval > 0.0 && !redrawRequested) {
+			const auto nextPresentTime = lastPresentTime + std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(std::chrono::duration<double>(interval));
+			const auto now = std::chrono::high_resolution_clock::now();
+			if (now < nextPresentTime) {
+				ScopedStageTimer timer(statistics, FrameStage::Wait);
+				glfwWaitEventsTimeout(std::chrono::duration<double>(nextPresentTime - now).count());
+				displayWaiting = false;
+				return false;
+			}
+		}
+
+		displayWaiting = false;
+		glfwPollEvents();
+		return true;
+	}
+
+	void recordFrameTime(const std::chrono::high_resolution_clock::time_point frameStart) {
+		auto now = std::chrono::high_resolution_clock::now();
+		accumulatedFrameTime += std::chrono::duration<double, std::milli>(now - frameStart).count();
+		timedFrames++;
+
+		if (now - lastFrameTimeReport >= std::chrono::seconds(1)) {
+			std::ostringstream title;
+			title << "RayTracing_OpenGLViewer - " << textureWidth << "x" << textureHeight << " - "
+				<< accumulatedFrameTime / timedFrames << " ms/frame";
+			if (accumulationEnabled && textureWidth > 0 && textureHeight > 0) {
+				title << " - " << displayedSamples / (static_cast<uint64_t>(textureWidth) * textureHeight) << " spp";
+			}
+			else {
+				title << " - " << getPixelFormatInfo(uploadFormat).name;
+			}
+			glfwSetWindowTitle(window, title.str().c_str());
+
+			accumulatedFrameTime = 0.0;
+			timedFrames = 0;
+			lastFrameTimeReport = now;
+		}
+	}
+
     
 
     static void keyCallback(GLFWwindow* window, const int key, const int scancode, const int action, const int mods) {
@@ -199,6 +998,32 @@ private:
                 case GLFW_KEY_ESCAPE:
                     glfwSetWindowShouldClose(window, GLFW_TRUE);
                     break;
+
+                case GLFW_KEY_A:
+                    if (action == GLFW_PRESS) {
+                        auto* app = reinterpret_cast<RayTracingOpenGLViewer*>(glfwGetWindowUserPointer(window));
+                        app->setAccumulation(!app->accumulationEnabled);
+                    }
+                    break;
+
+                case GLFW_KEY_F:
+                    if (action == GLFW_PRESS) {
+                        //Cycles through the upload formats
+                        auto* app = reinterpret_cast<RayTracingOpenGLViewer*>(glfwGetWindowUserPointer(window));
+                        app->setUploadFormat(static_cast<UploadFormat>((static_cast<int>(app->uploadFormat.load()) + 1) % 5));
+                    }
+                    break;
+
+                case GLFW_KEY_V:
+                    if (action == GLFW_PRESS) {
+                        auto* app = reinterpret_cast<RayTracingOpenGLViewer*>(glfwGetWindowUserPointer(window));
+                        app->setVSync(!app->vsyncEnabled);
+                    }
+                    break;
+
+                case GLFW_KEY_R:
+                    reinterpret_cast<RayTracingOpenGLViewer*>(glfwGetWindowUserPointer(window))->resetAccumulation();
+                    break;
                 
                 default:
                     break;
@@ -212,64 +1037,170 @@ private:
 
         auto* app = reinterpret_cast<RayTracingOpenGLViewer*>(glfwGetWindowUserPointer(window));
         app->resizeView(width, height);
+        app->redrawRequested = true;
 
     }
 
+    static void onWindowRefresh(GLFWwindow* window) {
+        reinterpret_cast<RayTracingOpenGLViewer*>(glfwGetWindowUserPointer(window))->redrawRequested = true;
+    }
+
     void initWindow()
     {
-		if (!glfwInit()) {
-			std::runtime_error("Failed to initialize GLFW!");
+		int width;
+		int height;
+		getImageSize(width, height);
+		for (int i = 0; i < 3; i++) {
+			frames.slot(i).resize(width, height);
+		}
+		if (backend == ViewerBackend::Null) {
+			return;
 		}
-		
-		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-#ifdef __APPLE__
-		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); 
-#endif	
-		
-        window = glfwCreateWindow(WIDTH, HEIGHT, "RayTracing_OpenGLViewer", nullptr, nullptr);
-		glfwMakeContextCurrent(window);
 
-		if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-			std::runtime_error("Failed to initialize GLAD");
+		window = createContextWindow(WIDTH, HEIGHT, "RayTracing_OpenGLViewer", backend == ViewerBackend::Hidden);
+
+		//Nothing to synchronize with when nobody looks at the window
+		if (backend == ViewerBackend::Hidden) {
+			vsyncEnabled = false;
 		}
 
         createBaseTriangleAndTexture();
         glfwSetWindowUserPointer(window, this);
-        glfwSetWindowSizeCallback(window, RayTracingOpenGLViewer::onWindowResized);
+        glfwSetFramebufferSizeCallback(window, RayTracingOpenGLViewer::onWindowResized);
+        glfwSetWindowRefreshCallback(window, RayTracingOpenGLViewer::onWindowRefresh);
 		
     }
-	
-    void mainLoop(std::function<std::vector<glm::vec3>()> createImage) {
+
+	//Consumes frames without any window or GL context, they only reach the frame sink
+	void headlessLoop() {
+		lastFrameTimeReport = std::chrono::high_resolution_clock::now();
+		while (!stopRequested && !renderThreadFailed) {
+			{
+				std::unique_lock<std::mutex> lock(wakeMutex);
+				wakeCondition.wait(lock, [this]() {
+					return frames.hasNewValue() || accumulatedFrames.hasNewValue() || tilesPending || renderThreadFailed || stopRequested;
+				});
+			}
+
+			if (frames.consume()) {
+				deliverFrame(frames.front());
+			}
+			if (accumulatedFrames.consume()) {
+				displayedSamples = accumulatedFrames.front().samples;
+				deliverAccumulation(accumulatedFrames.front());
+			}
+
+			if (tilesPending) {
+				bool wholeImageChanged;
+				bool tilesDrained;
+				{
+					ScopedStageTimer timer(statistics, FrameStage::Accumulate);
+					tilesDrained = drainTiles(wholeImageChanged);
+				}
+				if (tilesDrained) {
+					if (tilesAccumulated) {
+						displayedSamples = accumulation.samples;
+						deliverAccumulation(accumulation);
+					}
+					else {
+						deliverFrame(tileImage);
+					}
+				}
+			}
+		}
+	}
+
+    void mainLoop() {
 
         glfwSetKeyCallback(window, keyCallback);
-        while (!glfwWindowShouldClose(window)) {
-			glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-			glClear(GL_COLOR_BUFFER_BIT);
+		lastFrameTimeReport = std::chrono::high_resolution_clock::now();
+		lastPresentTime = lastFrameTimeReport;
+        while (!glfwWindowShouldClose(window) && !stopRequested) {
+			if (!waitForWork()) {
+				continue;
+			}
 
-			//Run the createImage function here from outside and then show it on the screen
-			if (createImage != nullptr) {
-				std::vector<glm::vec3> ret = createImage();
-				setImage(ret);
+			ScopedStageTimer frameTimer(statistics, FrameStage::Frame);
+			auto frameStart = std::chrono::high_resolution_clock::now();
+			redrawRequested = false;
+			if (swapIntervalChanged.exchange(false)) {
+				glfwSwapInterval(vsyncEnabled ? 1 : 0);
 			}
 
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, 256, 256, 0, GL_RGB, GL_FLOAT, inputPixels.data());
-			glBindTexture(GL_TEXTURE_2D, texture);
-			ourShader.use();
-			
-			glDrawArrays(GL_TRIANGLES, 0, 3);
+			//Show the latest frame published by the render thread, if there is a new one
+			if (frames.consume()) {
+				{
+					ScopedStageTimer timer(statistics, FrameStage::Upload);
+					ScopedGpuTimer gpuTimer(gpuTimers, FrameStage::GpuUpload);
+					uploadImage(frames.front());
+				}
+				deliverFrame(frames.front());
+			}
+			if (accumulatedFrames.consume()) {
+				{
+					ScopedStageTimer timer(statistics, FrameStage::Upload);
+					ScopedGpuTimer gpuTimer(gpuTimers, FrameStage::GpuUpload);
+					uploadAccumulatedFrame(accumulatedFrames.front());
+				}
+				deliverAccumulation(accumulatedFrames.front());
+			}
+
+			if (tilesPending) {
+				bool wholeImageChanged;
+				bool tilesDrained;
+				{
+					ScopedStageTimer timer(statistics, FrameStage::Accumulate);
+					tilesDrained = drainTiles(wholeImageChanged);
+				}
+				if (tilesDrained) {
+					{
+						ScopedStageTimer timer(statistics, FrameStage::Upload);
+						ScopedGpuTimer gpuTimer(gpuTimers, FrameStage::GpuUpload);
+						uploadTiles(wholeImageChanged);
+					}
+					if (tilesAccumulated) {
+						deliverAccumulation(accumulation);
+					}
+					else {
+						deliverFrame(tileImage);
+					}
+				}
+			}
+
+			if (renderThreadFailed) {
+				glfwSetWindowShouldClose(window, GLFW_TRUE);
+			}
+
+			{
+				ScopedStageTimer timer(statistics, FrameStage::Draw);
+				ScopedGpuTimer gpuTimer(gpuTimers, FrameStage::GpuDraw);
+				glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+				glClear(GL_COLOR_BUFFER_BIT);
 
-			glfwWaitEventsTimeout(1.0);
-			glfwSwapBuffers(window);
+				ourShader.use();
+				updateImageScale();
 
-			glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-			glClear(GL_COLOR_BUFFER_BIT);
+				glDrawArrays(GL_TRIANGLES, 0, 3);
+			}
+			recordFrameTime(frameStart);
+			gpuTimers.collect(statistics);
+
+			{
+				ScopedStageTimer timer(statistics, FrameStage::Swap);
+				glfwSwapBuffers(window);
+			}
+			lastPresentTime = std::chrono::high_resolution_clock::now();
         }
 
     }
 
     void cleanup() {
+		if (backend == ViewerBackend::Null) {
+			return;
+		}
+
+		pixelBuffers.destroy();
+		gpuTimers.destroy();
 
         glfwDestroyWindow(window);
 
@@ -277,8 +1208,58 @@ private:
 
     }
 
+	void exportStatistics() {
+		std::cout << "Frame statistics:\n";
+		statistics.writeReport(std::cout);
+		if (frameArenas.getPeakBytesPerFrame() > 0) {
+			std::cout << "Frame arena: " << frameArenas.getPeakBytesPerFrame() << " bytes per frame at peak, "
+				<< frameArenas.getCapacity() << " bytes reserved\n";
+		}
+
+		if (!statisticsFile.empty()) {
+			std::ofstream file(statisticsFile);
+			statistics.writeJSON(file);
+			file << "\n";
+			if (!file) {
+				std::cout << "Failed to write " << statisticsFile << std::endl;
+			}
+		}
+
+		if (!traceFile.empty()) {
+			std::ofstream file(traceFile);
+			TraceRecorder::getInstance().writeJSON(file);
+			if (!file) {
+				std::cout << "Failed to write " << traceFile << std::endl;
+			}
+			const size_t droppedEvents = TraceRecorder::getInstance().getDroppedEvents();
+			if (droppedEvents > 0) {
+				std::cerr << "Trace buffers were full, dropped " << droppedEvents << " events (at most "
+					<< TraceRecorder::EVENTS_PER_THREAD << " are kept per thread)" << std::endl;
+			}
+		}
+	}
+
     void resizeView(int width, int height) {
 		glViewport(0, 0, width, height);
+		viewWidth = width;
+		viewHeight = height;
     }
 
+	//Letterboxes the image so it keeps its aspect ratio whatever the window size
+	void updateImageScale() {
+		float scaleX = 1.0f;
+		float scaleY = 1.0f;
+		if (textureWidth > 0 && textureHeight > 0 && viewWidth > 0 && viewHeight > 0) {
+			const float imageAspect = static_cast<float>(textureWidth) / textureHeight;
+			const float viewAspect = static_cast<float>(viewWidth) / viewHeight;
+			if (imageAspect > viewAspect) {
+				scaleY = viewAspect / imageAspect;
+			}
+			else {
+				scaleX = imageAspect / viewAspect;
+			}
+		}
+		glUniform2f(glGetUniformLocation(ourShader.ID, "imageScale"), scaleX, scaleY);
+	}
+
 };
\ No newline at end of file
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RAYTRACING_OPENGLVIEWER_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define RAYTRACING_OPENGLVIEWER_AVX2
+#include <immintrin.h>
+#endif
+
+//Eight independent xoshiro128+ streams stored lane by lane, so one step advances all of them
+//with a handful of SIMD integer instructions. Each call yields eight floats in [0, 1).
+//xoshiro128+ has weak low bits, which is fine here since floats only use the upper 23.
+class Xoshiro128Plus8
+{
+public:
+	static const int LANES = 8;
+
+	explicit Xoshiro128Plus8(uint64_t seed = 0)
+	{
+		this->seed(seed);
+	}
+
+	//Lanes are seeded from consecutive splitmix64 outputs, the recommended way to fill xoshiro state
+	void seed(uint64_t seed)
+	{
+		uint64_t splitmix = seed;
+		for (int lane = 0; lane < LANES; lane++) {
+			for (int word = 0; word < 4; word += 2) {
+				const uint64_t value = splitMix64(splitmix);
+				state[word][lane] = static_cast<uint32_t>(value);
+				state[word + 1][lane] = static_cast<uint32_t>(value >> 32);
+			}
+		}
+	}
+
+	//Writes eight uniform floats to output, which does not need to be aligned
+	void next8(float* output)
+	{
+#if defined(RAYTRACING_OPENGLVIEWER_AVX2)
+		__m256i s0 = _mm256_load_si256(reinterpret_cast<const __m256i*>(state[0]));
+		__m256i s1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(state[1]));
+		__m256i s2 = _mm256_load_si256(reinterpret_cast<const __m256i*>(state[2]));
+		__m256i s3 = _mm256_load_si256(reinterpret_cast<const __m256i*>(state[3]));
+
+		const __m256i result = _mm256_add_epi32(s0, s3);
+		const __m256i t = _mm256_slli_epi32(s1, 9);
+		s2 = _mm256_xor_si256(s2, s0);
+		s3 = _mm256_xor_si256(s3, s1);
+		s1 = _mm256_xor_si256(s1, s2);
+		s0 = _mm256_xor_si256(s0, s3);
+		s2 = _mm256_xor_si256(s2, t);
+		s3 = _mm256_or_si256(_mm256_slli_epi32(s3, 11), _mm256_srli_epi32(s3, 21));
+
+		_mm256_store_si256(reinterpret_cast<__m256i*>(state[0]), s0);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(state[1]), s1);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(state[2]), s2);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(state[3]), s3);
+
+		//Upper 23 bits as the mantissa of a float in [1, 2), minus one
+		const __m256i mantissa = _mm256_or_si256(_mm256_srli_epi32(result, 9), _mm256_set1_epi32(0x3f800000));
+		_mm256_storeu_ps(output, _mm256_sub_ps(_mm256_castsi256_ps(mantissa), _mm256_set1_ps(1.0f)));
+#elif defined(RAYTRACING_OPENGLVIEWER_SSE2)
+		for (int half = 0; half < LANES; half += 4) {
+			__m128i s0 = _mm_load_si128(reinterpret_cast<const __m128i*>(state[0] + half));
+			__m128i s1 = _mm_load_si128(reinterpret_cast<const __m128i*>(state[1] + half));
+			__m128i s2 = _mm_load_si128(reinterpret_cast<const __m128i*>(state[2] + half));
+			__m128i s3 = _mm_load_si128(reinterpret_cast<const __m128i*>(state[3] + half));
+
+			const __m128i result = _mm_add_epi32(s0, s3);
+			const __m128i t = _mm_slli_epi32(s1, 9);
+			s2 = _mm_xor_si128(s2, s0);
+			s3 = _mm_xor_si128(s3, s1);
+			s1 = _mm_xor_si128(s1, s2);
+			s0 = _mm_xor_si128(s0, s3);
+			s2 = _mm_xor_si128(s2, t);
+			s3 = _mm_or_si128(_mm_slli_epi32(s3, 11), _mm_srli_epi32(s3, 21));
+
+			_mm_store_si128(reinterpret_cast<__m128i*>(state[0] + half), s0);
+			_mm_store_si128(reinterpret_cast<__m128i*>(state[1] + half), s1);
+			_mm_store_si128(reinterpret_cast<__m128i*>(state[2] + half), s2);
+			_mm_store_si128(reinterpret_cast<__m128i*>(state[3] + half), s3);
+
+			const __m128i mantissa = _mm_or_si128(_mm_srli_epi32(result, 9), _mm_set1_epi32(0x3f800000));
+			_mm_storeu_ps(output + half, _mm_sub_ps(_mm_castsi128_ps(mantissa), _mm_set1_ps(1.0f)));
+		}
+#else
+		for (int lane = 0; lane < LANES; lane++) {
+			output[lane] = toFloat(nextScalar(lane));
+		}
+#endif
+	}
+
+	//Raw 32-bit output of one lane, the same sequence next8 draws its floats from
+	uint32_t nextScalar(int lane)
+	{
+		uint32_t& s0 = state[0][lane];
+		uint32_t& s1 = state[1][lane];
+		uint32_t& s2 = state[2][lane];
+		uint32_t& s3 = state[3][lane];
+
+		const uint32_t result = s0 + s3;
+		const uint32_t t = s1 << 9;
+		s2 ^= s0;
+		s3 ^= s1;
+		s1 ^= s2;
+		s0 ^= s3;
+		s2 ^= t;
+		s3 = (s3 << 11) | (s3 >> 21);
+		return result;
+	}
+
+	static float toFloat(uint32_t bits)
+	{
+		const uint32_t mantissa = (bits >> 9) | 0x3f800000u;
+		float value;
+		std::memcpy(&value, &mantissa, sizeof(value));
+		return value - 1.0f;
+	}
+
+private:
+	alignas(32) uint32_t state[4][LANES];
+
+	static uint64_t splitMix64(uint64_t& x)
+	{
+		uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+};
+
+//Uniform floats in [0, 1) for one thread, drawn eight at a time from Xoshiro128Plus8.
+//Bulk requests go straight to the generator; single draws are served from a small buffer.
+class Sampler
+{
+public:
+	explicit Sampler(uint64_t seed = 0) : generator(seed)
+	{
+	}
+
+	void seed(uint64_t seed)
+	{
+		generator.seed(seed);
+		available = 0;
+	}
+
+	float next()
+	{
+		if (available == 0) {
+			generator.next8(buffer);
+			available = Xoshiro128Plus8::LANES;
+		}
+		return buffer[Xoshiro128Plus8::LANES - available--];
+	}
+
+	//Fills output with count uniform floats, e.g. the rgb channels of a whole row of pixels
+	void fill(float* output, size_t count)
+	{
+		while (available > 0 && count > 0) {
+			*output++ = next();
+			count--;
+		}
+		while (count >= Xoshiro128Plus8::LANES) {
+			generator.next8(output);
+			output += Xoshiro128Plus8::LANES;
+			count -= Xoshiro128Plus8::LANES;
+		}
+		while (count > 0) {
+			*output++ = next();
+			count--;
+		}
+	}
+
+private:
+	Xoshiro128Plus8 generator;
+	float buffer[Xoshiro128Plus8::LANES];
+	int available = 0;
+};
+
+//Philox4x32-10 counter-based generator (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+//Stateless: the output only depends on the counter and the key, so a value can be computed
+//from any thread in any order and always comes out the same.
+struct Philox4x32
+{
+	static void generate(const uint32_t counter[4], const uint32_t key[2], uint32_t output[4])
+	{
+		uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+		uint32_t k0 = key[0], k1 = key[1];
+		for (int round = 0; round < 10; round++) {
+			if (round > 0) {
+				k0 += 0x9E3779B9u;
+				k1 += 0xBB67AE85u;
+			}
+			const uint64_t product0 = static_cast<uint64_t>(0xD2511F53u) * c0;
+			const uint64_t product1 = static_cast<uint64_t>(0xCD9E8D57u) * c2;
+			const uint32_t next0 = static_cast<uint32_t>(product1 >> 32) ^ c1 ^ k0;
+			const uint32_t next2 = static_cast<uint32_t>(product0 >> 32) ^ c3 ^ k1;
+			c1 = static_cast<uint32_t>(product1);
+			c3 = static_cast<uint32_t>(product0);
+			c0 = next0;
+			c2 = next2;
+		}
+		output[0] = c0;
+		output[1] = c1;
+		output[2] = c2;
+		output[3] = c3;
+	}
+};
+
+//Random numbers for one sample of one pixel, addressed by dimension instead of drawn in sequence.
+//Dimension d of (seed, pixel, sample) is always the same float, which makes frames bit-identical
+//however the pixels are split between threads. One Philox call yields four consecutive dimensions.
+class PixelSampler
+{
+public:
+	PixelSampler(uint64_t seed, uint32_t pixel, uint32_t sample)
+	{
+		key[0] = static_cast<uint32_t>(seed);
+		key[1] = static_cast<uint32_t>(seed >> 32);
+		counter[0] = pixel;
+		counter[1] = sample;
+		counter[2] = 0;
+		counter[3] = 0;
+		Philox4x32::generate(counter, key, block);
+	}
+
+	float get(uint32_t dimension)
+	{
+		const uint32_t blockIndex = dimension >> 2;
+		if (blockIndex != counter[2]) {
+			counter[2] = blockIndex;
+			Philox4x32::generate(counter, key, block);
+		}
+		return Xoshiro128Plus8::toFloat(block[dimension & 3]);
+	}
+
+	//Index of a pixel as used for the counter, unique as long as width * height fits in 32 bits
+	static uint32_t pixelIndex(int x, int y, int width)
+	{
+		return static_cast<uint32_t>(y) * static_cast<uint32_t>(width) + static_cast<uint32_t>(x);
+	}
+
+private:
+	uint32_t key[2];
+	uint32_t counter[4];
+	uint32_t block[4];
+};
@@ -0,0 +1,415 @@
+#pragma once
+
+#include "Bvh.hpp"
+#include "CompressedBvh.hpp"
+#include "FrameBuffer.hpp"
+#include "Geometry.hpp"
+#include "RayPacket.hpp"
+#include "Sampler.hpp"
+#include "WideBvh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+//Pinhole camera; generateRay maps [0, 1]^2 image coordinates, y pointing down, to primary rays
+struct Camera
+{
+	glm::vec3 position = glm::vec3(0.0f);
+	glm::vec3 forward = glm::vec3(0.0f, 0.0f, -1.0f);
+	glm::vec3 right = glm::vec3(1.0f, 0.0f, 0.0f);
+	glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
+	float tanHalfFov = 0.5f;
+
+	void lookAt(const glm::vec3& eye, const glm::vec3& target, const glm::vec3& worldUp, float verticalFovDegrees)
+	{
+		position = eye;
+		forward = glm::normalize(target - eye);
+		right = glm::normalize(glm::cross(forward, worldUp));
+		up = glm::cross(right, forward);
+		tanHalfFov = std::tan(glm::radians(verticalFovDegrees) * 0.5f);
+	}
+
+	Ray generateRay(float x, float y, float aspectRatio) const
+	{
+		const float screenX = (2.0f * x - 1.0f) * tanHalfFov * aspectRatio;
+		const float screenY = (1.0f - 2.0f * y) * tanHalfFov;
+		return Ray(position, glm::normalize(forward + right * screenX + up * screenY));
+	}
+};
+
+//Procedural test scenes, so the ray tracer has a realistic workload without loading files
+namespace ProceduralScene {
+
+	//UV sphere with segments rings of 2 * segments quads
+	inline void addSphere(TriangleMesh& mesh, const glm::vec3& center, float radius, int segments, const glm::vec3& color)
+	{
+		const float pi = 3.14159265358979323846f;
+		const uint32_t first = static_cast<uint32_t>(mesh.vertices.size());
+		const int columns = 2 * segments;
+		for (int ring = 0; ring <= segments; ring++) {
+			const float theta = pi * ring / segments;
+			for (int column = 0; column < columns; column++) {
+				const float phi = 2.0f * pi * column / columns;
+				mesh.addVertex(center + radius * glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+			}
+		}
+		for (int ring = 0; ring < segments; ring++) {
+			for (int column = 0; column < columns; column++) {
+				const uint32_t a = first + ring * columns + column;
+				const uint32_t b = first + ring * columns + (column + 1) % columns;
+				const uint32_t c = a + columns;
+				const uint32_t d = b + columns;
+				//The rings at the poles collapse into points, their degenerate triangles are skipped
+				if (ring > 0) {
+					mesh.addTriangle(a, b, c, color);
+				}
+				if (ring < segments - 1) {
+					mesh.addTriangle(b, d, c, color);
+				}
+			}
+		}
+	}
+
+	inline void addQuad(TriangleMesh& mesh, const glm::vec3& corner, const glm::vec3& edge1, const glm::vec3& edge2, const glm::vec3& color)
+	{
+		const uint32_t a = mesh.addVertex(corner);
+		const uint32_t b = mesh.addVertex(corner + edge1);
+		const uint32_t c = mesh.addVertex(corner + edge1 + edge2);
+		const uint32_t d = mesh.addVertex(corner + edge2);
+		mesh.addTriangle(a, b, c, color);
+		mesh.addTriangle(a, c, d, color);
+	}
+
+	inline void addBox(TriangleMesh& mesh, const glm::vec3& min, const glm::vec3& max, const glm::vec3& color)
+	{
+		const glm::vec3 size = max - min;
+		const glm::vec3 x(size.x, 0.0f, 0.0f);
+		const glm::vec3 y(0.0f, size.y, 0.0f);
+		const glm::vec3 z(0.0f, 0.0f, size.z);
+		addQuad(mesh, min, y, x, color);
+		addQuad(mesh, min + z, x, y, color);
+		addQuad(mesh, min, z, y, color);
+		addQuad(mesh, min + x, y, z, color);
+		addQuad(mesh, min, x, z, color);
+		addQuad(mesh, min + y, z, x, color);
+	}
+
+	//Ground plane with a 5x5 grid of spheres and boxes. detail scales the tessellation,
+	//a sphere has about 4 * (4 * detail)^2 triangles.
+	inline TriangleMesh createDemoScene(int detail = 4)
+	{
+		TriangleMesh mesh;
+		addQuad(mesh, glm::vec3(-20.0f, 0.0f, -20.0f), glm::vec3(0.0f, 0.0f, 40.0f), glm::vec3(40.0f, 0.0f, 0.0f), glm::vec3(0.7f));
+
+		const int grid = 5;
+		const int segments = std::max(3, 4 * detail);
+		for (int i = 0; i < grid; i++) {
+			for (int j = 0; j < grid; j++) {
+				const glm::vec3 color(0.25f + 0.6f * i / (grid - 1), 0.3f + 0.4f * ((i + j) % 2), 0.25f + 0.6f * j / (grid - 1));
+				const glm::vec3 base(2.5f * (i - grid / 2), 0.0f, -2.5f * j);
+				if ((i + j) % 3 == 2) {
+					addBox(mesh, base + glm::vec3(-0.7f, 0.0f, -0.7f), base + glm::vec3(0.7f, 1.4f, 0.7f), color);
+				}
+				else {
+					addSphere(mesh, base + glm::vec3(0.0f, 1.0f, 0.0f), 1.0f, segments, color);
+				}
+			}
+		}
+		return mesh;
+	}
+
+	//Looks at the grid of createDemoScene from the front, slightly above
+	inline Camera createDemoCamera()
+	{
+		Camera camera;
+		camera.lookAt(glm::vec3(0.0f, 4.5f, 7.0f), glm::vec3(0.0f, 0.5f, -5.0f), glm::vec3(0.0f, 1.0f, 0.0f), 50.0f);
+		return camera;
+	}
+
+}
+
+//Acceleration structures the RayTracer can trace rays with
+enum class BvhLayout
+{
+	Binary,
+	Wide,
+	Compressed
+};
+
+inline const char* getBvhLayoutName(BvhLayout layout)
+{
+	static const char* names[] = { "binary", "wide", "compressed" };
+	return names[static_cast<int>(layout)];
+}
+
+//How the RayTracer traces its rays: one at a time through the selected BvhLayout, or in packets
+//of the primary rays of 4x2 or 4x4 pixels and their shadow rays, which needs BvhLayout::Binary
+enum class RayTraversal
+{
+	Single,
+	Packet8,
+	Packet16
+};
+
+inline const char* getRayTraversalName(RayTraversal traversal)
+{
+	static const char* names[] = { "single", "packet8", "packet16" };
+	return names[static_cast<int>(traversal)];
+}
+
+//Reference CPU ray tracer: primary rays, one directional light with shadow rays and a sky.
+//renderTile has the signature of a TileScheduler kernel once the sample index is bound.
+class RayTracer
+{
+public:
+	//The BVH is built on the pool if one is given, e.g. the one of the TileScheduler rendering the frames
+	void setScene(TriangleMesh sceneMesh, TaskPool* pool = nullptr)
+	{
+		mesh = std::move(sceneMesh);
+		bvh.build(mesh, pool);
+		buildLayout();
+	}
+
+	//Not to be changed while a frame is rendered. Best set before setScene, which builds the structure of
+	//the current layout; afterwards a different layout rebuilds it, on the calling thread.
+	//Packets only traverse the binary BVH, so other layouts are rejected while a packet traversal is selected.
+	void setBvhLayout(BvhLayout layout)
+	{
+		if (layout == bvhLayout) {
+			return;
+		}
+		if (layout != BvhLayout::Binary && rayTraversal != RayTraversal::Single) {
+			throw std::runtime_error(std::string("Packet traversal needs the binary BVH, not the ") + getBvhLayoutName(layout) + " one");
+		}
+		bvhLayout = layout;
+		if (mesh.getTriangleCount() > 0) {
+			buildLayout();
+		}
+	}
+
+	BvhLayout getBvhLayout() const
+	{
+		return bvhLayout;
+	}
+
+	//Not to be changed while a frame is rendered either. Packet traversals need BvhLayout::Binary.
+	void setRayTraversal(RayTraversal traversal)
+	{
+		if (traversal != RayTraversal::Single && bvhLayout != BvhLayout::Binary) {
+			throw std::runtime_error(std::string("Packet traversal needs the binary BVH, not the ") + getBvhLayoutName(bvhLayout) + " one");
+		}
+		rayTraversal = traversal;
+	}
+
+	RayTraversal getRayTraversal() const
+	{
+		return rayTraversal;
+	}
+
+	void setCamera(const Camera& newCamera)
+	{
+		camera = newCamera;
+	}
+
+	//Empty unless the layout is BvhLayout::Binary, the other layouts drop it once they are collapsed from it
+	const Bvh& getBvh() const
+	{
+		return bvh;
+	}
+
+	//Empty unless the layout is BvhLayout::Wide
+	const WideBvh& getWideBvh() const
+	{
+		return wideBvh;
+	}
+
+	//Empty unless the layout is BvhLayout::Compressed
+	const CompressedWideBvh& getCompressedBvh() const
+	{
+		return compressedBvh;
+	}
+
+	const TriangleMesh& getMesh() const
+	{
+		return mesh;
+	}
+
+	//One jittered sample per pixel of the tile, the jitter is keyed by pixel and sample index
+	//so the result does not depend on which thread renders the tile
+	void renderTile(const FrameView& frame, const ImageRegion& tile, uint32_t sample, uint64_t seed) const
+	{
+		if (rayTraversal == RayTraversal::Packet8) {
+			renderTilePackets<8>(frame, tile, sample, seed);
+			return;
+		}
+		if (rayTraversal == RayTraversal::Packet16) {
+			renderTilePackets<16>(frame, tile, sample, seed);
+			return;
+		}
+
+		const float aspectRatio = static_cast<float>(frame.width) / frame.height;
+		for (int y = tile.y; y < tile.y + tile.height; y++) {
+			glm::vec3* row = frame.row(y);
+			for (int x = tile.x; x < tile.x + tile.width; x++) {
+				PixelSampler sampler(seed, PixelSampler::pixelIndex(x, y, frame.width), sample);
+				Ray ray = camera.generateRay((x + sampler.get(0)) / frame.width, (y + sampler.get(1)) / frame.height, aspectRatio);
+				row[x] = shade(ray);
+			}
+		}
+	}
+
+	glm::vec3 shade(Ray& ray) const
+	{
+		Hit hit;
+		if (!intersect(ray, hit)) {
+			return getSkyColor(ray.direction);
+		}
+
+		float lighting = AMBIENT;
+		Ray shadowRay;
+		const float cosine = getShadowRay(ray, hit, shadowRay);
+		if (cosine > 0.0f && !occluded(shadowRay)) {
+			lighting += cosine;
+		}
+		return mesh.getColor(hit.triangle) * lighting;
+	}
+
+private:
+	const float AMBIENT = 0.15f;
+	const float SHADOW_BIAS = 1e-3f;
+
+	TriangleMesh mesh;
+	Bvh bvh;
+	WideBvh wideBvh;
+	CompressedWideBvh compressedBvh;
+	BvhLayout bvhLayout = BvhLayout::Wide;
+	Camera camera;
+	glm::vec3 lightDirection = glm::normalize(glm::vec3(0.5f, 1.0f, 0.3f));
+
+	RayTraversal rayTraversal = RayTraversal::Single;
+
+	//Cosine between the surface and the light, and if it is positive the ray towards the light
+	float getShadowRay(const Ray& ray, const Hit& hit, Ray& shadowRay) const
+	{
+		glm::vec3 normal = mesh.getNormal(hit.triangle);
+		if (glm::dot(normal, ray.direction) > 0.0f) {
+			normal = -normal;
+		}
+		const float cosine = glm::dot(normal, lightDirection);
+		if (cosine > 0.0f) {
+			const glm::vec3 position = ray.origin + ray.direction * hit.t;
+			shadowRay = Ray(position + normal * SHADOW_BIAS, lightDirection, 0.0f);
+		}
+		return cosine;
+	}
+
+	//Same image as the single ray path, traced a block of 4 x (Size / 4) pixels at a time
+	template <int Size>
+	void renderTilePackets(const FrameView& frame, const ImageRegion& tile, uint32_t sample, uint64_t seed) const
+	{
+		const int blockWidth = 4;
+		const int blockHeight = Size / blockWidth;
+		const float aspectRatio = static_cast<float>(frame.width) / frame.height;
+		for (int blockY = tile.y; blockY < tile.y + tile.height; blockY += blockHeight) {
+			for (int blockX = tile.x; blockX < tile.x + tile.width; blockX += blockWidth) {
+				RayPacket<Size> packet;
+				for (int lane = 0; lane < Size; lane++) {
+					const int x = blockX + lane % blockWidth;
+					const int y = blockY + lane / blockWidth;
+					if (x < tile.x + tile.width && y < tile.y + tile.height) {
+						PixelSampler sampler(seed, PixelSampler::pixelIndex(x, y, frame.width), sample);
+						packet.setRay(lane, camera.generateRay((x + sampler.get(0)) / frame.width, (y + sampler.get(1)) / frame.height, aspectRatio));
+					}
+				}
+				const uint32_t hits = intersectPacket(bvh, packet);
+
+				RayPacket<Size> shadowPacket;
+				float cosines[Size];
+				for (int lane = 0; lane < Size; lane++) {
+					cosines[lane] = 0.0f;
+					if (hits & (1u << lane)) {
+						Ray shadowRay;
+						cosines[lane] = getShadowRay(packet.rays[lane], packet.hits[lane], shadowRay);
+						if (cosines[lane] > 0.0f) {
+							shadowPacket.setRay(lane, shadowRay);
+						}
+					}
+				}
+				const uint32_t occludedRays = occludedPacket(bvh, shadowPacket);
+
+				for (int lane = 0; lane < Size; lane++) {
+					if (!(packet.activeMask & (1u << lane))) {
+						continue;
+					}
+					glm::vec3& pixel = frame.row(blockY + lane / blockWidth)[blockX + lane % blockWidth];
+					if (!(hits & (1u << lane))) {
+						pixel = getSkyColor(packet.rays[lane].direction);
+						continue;
+					}
+					float lighting = AMBIENT;
+					if ((shadowPacket.activeMask & ~occludedRays) & (1u << lane)) {
+						lighting += cosines[lane];
+					}
+					pixel = mesh.getColor(packet.hits[lane].triangle) * lighting;
+				}
+			}
+		}
+	}
+
+	//Only the structure the layout traces with is kept. The binary BVH is dropped once the wide one is
+	//collapsed from it, packets trace it directly but only run with BvhLayout::Binary.
+	void buildLayout()
+	{
+		wideBvh = WideBvh();
+		compressedBvh = CompressedWideBvh();
+		if (bvh.getNodes().empty()) {
+			//Dropped by the previous layout
+			bvh.build(mesh);
+		}
+		if (bvhLayout == BvhLayout::Binary) {
+			return;
+		}
+		wideBvh.build(bvh);
+		bvh = Bvh();
+		if (bvhLayout == BvhLayout::Compressed) {
+			compressedBvh.build(wideBvh);
+			wideBvh = WideBvh();
+		}
+	}
+
+	bool intersect(Ray& ray, Hit& hit) const
+	{
+		switch (bvhLayout) {
+		case BvhLayout::Wide:
+			return wideBvh.intersect(ray, hit);
+		case BvhLayout::Compressed:
+			return compressedBvh.intersect(ray, hit);
+		case BvhLayout::Binary:
+		default:
+			return bvh.intersect(ray, hit);
+		}
+	}
+
+	bool occluded(const Ray& ray) const
+	{
+		switch (bvhLayout) {
+		case BvhLayout::Wide:
+			return wideBvh.occluded(ray);
+		case BvhLayout::Compressed:
+			return compressedBvh.occluded(ray);
+		case BvhLayout::Binary:
+		default:
+			return bvh.occluded(ray);
+		}
+	}
+
+	static glm::vec3 getSkyColor(const glm::vec3& direction)
+	{
+		const float t = 0.5f * (direction.y + 1.0f);
+		return glm::mix(glm::vec3(1.0f), glm::vec3(0.5f, 0.7f, 1.0f), t);
+	}
+};
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskGroup;
+
+//Fixed pool of worker threads with one task deque per worker. A worker runs its own tasks
+//newest first, whose data is most likely still in its cache, and once it runs dry steals the
+//oldest task from another deque, for recursive work the biggest piece left. Work spreads over
+//all cores without a single shared queue everybody contends on.
+//The thread waiting for a TaskGroup helps running tasks and only sleeps when there is nothing to take.
+class TaskPool
+{
+public:
+	//threadCount includes the thread that waits for the tasks, 0 uses every hardware thread
+	explicit TaskPool(int threadCount = 0)
+	{
+		if (threadCount <= 0) {
+			threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+		}
+		//One deque per worker plus one nobody owns, for tasks spawned from outside a pool without workers
+		for (int i = 0; i < threadCount; i++) {
+			queues.emplace_back(new TaskQueue);
+		}
+		for (int i = 0; i < threadCount - 1; i++) {
+			workers.emplace_back([this, i]() { workerLoop(i); });
+		}
+	}
+
+	~TaskPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			stopping = true;
+		}
+		wakeCondition.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+	}
+
+	TaskPool(const TaskPool&) = delete;
+	TaskPool& operator=(const TaskPool&) = delete;
+
+	int getThreadCount() const
+	{
+		return static_cast<int>(workers.size()) + 1;
+	}
+
+	//Calls body(i) for every i in [0, count) on the pool and returns once all calls are done.
+	//Workers start with the lower indices, threads stealing from them with the higher ones.
+	void parallelFor(size_t count, const std::function<void(size_t)>& body);
+
+private:
+	friend class TaskGroup;
+
+	struct Task {
+		std::function<void()> function;
+		TaskGroup* group;
+	};
+
+	struct TaskQueue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	//Which deque the calling thread owns, -1 for threads outside the pool
+	struct ThreadContext {
+		const TaskPool* pool = nullptr;
+		int queue = -1;
+	};
+
+	std::vector<std::unique_ptr<TaskQueue>> queues;
+	std::vector<std::thread> workers;
+	std::atomic<size_t> nextQueue{ 0 };
+
+	//Tasks sitting in any deque; idle workers sleep until it becomes non-zero
+	std::atomic<size_t> queuedTasks{ 0 };
+	std::mutex sleepMutex;
+	std::condition_variable wakeCondition;
+	bool stopping = false;
+	//Threads sleeping in TaskGroup::wait, woken as well when the last task of a group finishes
+	size_t waitingGroups = 0;
+
+	static ThreadContext& getThreadContext()
+	{
+		static thread_local ThreadContext context;
+		return context;
+	}
+
+	int getCurrentQueue() const
+	{
+		const ThreadContext& context = getThreadContext();
+		return context.pool == this ? context.queue : -1;
+	}
+
+	//Workers push to their own deque, other threads deal their tasks out to the workers round-robin
+	void push(Task task)
+	{
+		int queue = getCurrentQueue();
+		if (queue < 0) {
+			queue = workers.empty() ? static_cast<int>(queues.size()) - 1 : static_cast<int>(nextQueue++ % workers.size());
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			queuedTasks++;
+		}
+		{
+			std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+			queues[queue]->tasks.push_back(std::move(task));
+		}
+		wakeCondition.notify_one();
+	}
+
+	//Runs one task from the own deque or, failing that, one stolen from another deque
+	bool tryRunTask(int ownQueue);
+
+	void notifyGroupFinished()
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		if (waitingGroups > 0) {
+			wakeCondition.notify_all();
+		}
+	}
+
+	void workerLoop(int index)
+	{
+		ThreadContext& context = getThreadContext();
+		context.pool = this;
+		context.queue = index;
+
+		while (true) {
+			if (tryRunTask(index)) {
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			wakeCondition.wait(lock, [this]() { return stopping || queuedTasks > 0; });
+			if (stopping && queuedTasks == 0) {
+				return;
+			}
+		}
+	}
+};
+
+//Set of tasks that can be waited for together. Tasks may spawn further tasks into the same or
+//another group, e.g. for recursive divide and conquer. The first exception thrown by a task is
+//rethrown by wait().
+class TaskGroup
+{
+public:
+	explicit TaskGroup(TaskPool& pool) : pool(pool)
+	{
+	}
+
+	//Waits for the remaining tasks but drops their exceptions, call wait() to see them
+	~TaskGroup()
+	{
+		try {
+			wait();
+		}
+		catch (...) {
+		}
+	}
+
+	TaskGroup(const TaskGroup&) = delete;
+	TaskGroup& operator=(const TaskGroup&) = delete;
+
+	void spawn(std::function<void()> function)
+	{
+		remaining++;
+		pool.push({ std::move(function), this });
+	}
+
+	void wait()
+	{
+		const int ownQueue = pool.getCurrentQueue();
+		while (remaining.load(std::memory_order_acquire) > 0) {
+			if (pool.tryRunTask(ownQueue)) {
+				continue;
+			}
+			//The remaining tasks run elsewhere, sleep until new tasks are queued or the last one finished
+			std::unique_lock<std::mutex> lock(pool.sleepMutex);
+			pool.waitingGroups++;
+			pool.wakeCondition.wait(lock, [this]() {
+				return pool.queuedTasks > 0 || remaining.load(std::memory_order_acquire) == 0;
+			});
+			pool.waitingGroups--;
+		}
+
+		std::lock_guard<std::mutex> lock(exceptionMutex);
+		if (exception) {
+			std::exception_ptr rethrown = exception;
+			exception = nullptr;
+			std::rethrow_exception(rethrown);
+		}
+	}
+
+private:
+	friend class TaskPool;
+
+	TaskPool& pool;
+	std::atomic<size_t> remaining{ 0 };
+	std::mutex exceptionMutex;
+	std::exception_ptr exception;
+
+	void run(std::function<void()>& function)
+	{
+		try {
+			function();
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(exceptionMutex);
+			if (!exception) {
+				exception = std::current_exception();
+			}
+		}
+		//The group may be gone as soon as remaining drops to zero
+		TaskPool& taskPool = pool;
+		if (remaining.fetch_sub(1, std::memory_order_release) == 1) {
+			taskPool.notifyGroupFinished();
+		}
+	}
+};
+
+inline bool TaskPool::tryRunTask(int ownQueue)
+{
+	Task task;
+	bool found = false;
+	if (ownQueue >= 0) {
+		TaskQueue& queue = *queues[ownQueue];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.tasks.empty()) {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+			found = true;
+		}
+	}
+
+	//Steal from the front, the oldest task, which its owner would get to last. The unowned deque stands in
+	//for an owner and is taken newest first.
+	const int queueCount = static_cast<int>(queues.size());
+	for (int i = 1; !found && i <= queueCount; i++) {
+		const int victim = (std::max(ownQueue, 0) + i) % queueCount;
+		if (victim == ownQueue) {
+			continue;
+		}
+		TaskQueue& queue = *queues[victim];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty()) {
+			continue;
+		}
+		if (victim == queueCount - 1) {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		else {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+		found = true;
+	}
+
+	if (!found) {
+		return false;
+	}
+	queuedTasks--;
+	task.group->run(task.function);
+	return true;
+}
+
+inline void TaskPool::parallelFor(size_t count, const std::function<void(size_t)>& body)
+{
+	TaskGroup group(*this);
+	//Spawned last to first, so the owners of the deques pop the lower indices first and thieves take the higher ones
+	for (size_t i = count; i-- > 0;) {
+		group.spawn([&body, i]() { body(i); });
+	}
+	group.wait();
+}
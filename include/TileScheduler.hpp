@@ -0,0 +1,186 @@
+#pragma once
+
+#include "FrameBuffer.hpp"
+#include "TaskPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+//Order the tiles of a frame are handed to the workers in
+enum class TileOrder {
+	RowMajor,	//left to right, top to bottom
+	Morton,		//Z-order curve, nearby tiles are rendered close together in time
+	Hilbert,	//Hilbert curve, like Morton but without the long jumps between quadrants
+	Spiral		//center first, then rings around it, for a usable preview sooner
+};
+
+inline const char* getTileOrderName(TileOrder order)
+{
+	static const char* names[] = { "rowMajor", "morton", "hilbert", "spiral" };
+	return names[static_cast<int>(order)];
+}
+
+//Splits frames into square tiles and renders them in parallel on a TaskPool.
+//The kernel writes the pixels of its tile straight into the frame, e.g. the buffer the viewer
+//lends to run(), so no per-tile copies or assembly are needed:
+//
+//	TileScheduler scheduler;
+//	viewer->run([&scheduler](FrameView& frame) { scheduler.render(frame, renderTile); });
+class TileScheduler
+{
+public:
+	//Called concurrently for different tiles; it must only write pixels inside its tile
+	typedef std::function<void(const FrameView& frame, const ImageRegion& tile)> TileKernel;
+
+	static const int DEFAULT_TILE_SIZE = 32;
+
+	explicit TileScheduler(int threadCount = 0, int tileSize = DEFAULT_TILE_SIZE, TileOrder order = TileOrder::RowMajor)
+		: pool(threadCount), tileOrder(order)
+	{
+		setTileSize(tileSize);
+	}
+
+	void setTileOrder(TileOrder order)
+	{
+		tileOrder = order;
+		tiles.clear();
+	}
+
+	TileOrder getTileOrder() const
+	{
+		return tileOrder;
+	}
+
+	void setTileSize(int size)
+	{
+		if (size <= 0) {
+			throw std::runtime_error("Tile size has to be positive");
+		}
+		tileSize = size;
+		tiles.clear();
+	}
+
+	//Renders every tile of the frame and returns once all of them are done.
+	//Rethrows the first exception thrown by the kernel.
+	void render(const FrameView& frame, const TileKernel& kernel)
+	{
+		forEachTile(frame.width, frame.height, [&frame, &kernel](const ImageRegion& tile) {
+			kernel(frame, tile);
+		});
+	}
+
+	//Same for frames of any other layout, e.g. a PlanarFrameView the kernel captures
+	void forEachTile(int width, int height, const std::function<void(const ImageRegion& tile)>& kernel)
+	{
+		if (width != tilesWidth || height != tilesHeight || tiles.empty()) {
+			splitIntoTiles(width, height);
+		}
+		pool.parallelFor(tiles.size(), [this, &kernel](size_t index) {
+			kernel(tiles[index]);
+		});
+	}
+
+	//The pool is free for other work between frames
+	TaskPool& getPool()
+	{
+		return pool;
+	}
+
+	int getThreadCount() const
+	{
+		return pool.getThreadCount();
+	}
+
+private:
+	TaskPool pool;
+	int tileSize = DEFAULT_TILE_SIZE;
+	TileOrder tileOrder = TileOrder::RowMajor;
+	std::vector<ImageRegion> tiles;
+	int tilesWidth = 0;
+	int tilesHeight = 0;
+
+	void splitIntoTiles(int width, int height)
+	{
+		const int tilesX = (width + tileSize - 1) / tileSize;
+		const int tilesY = (height + tileSize - 1) / tileSize;
+
+		//Sort key of every tile in the chosen order, row-major index as the tie breaker
+		std::vector<std::pair<uint64_t, int>> keys;
+		keys.reserve(static_cast<size_t>(tilesX) * tilesY);
+		for (int tileY = 0; tileY < tilesY; tileY++) {
+			for (int tileX = 0; tileX < tilesX; tileX++) {
+				keys.emplace_back(getTileKey(tileX, tileY, tilesX, tilesY), tileY * tilesX + tileX);
+			}
+		}
+		std::sort(keys.begin(), keys.end());
+
+		tiles.clear();
+		for (const std::pair<uint64_t, int>& key : keys) {
+			const int x = key.second % tilesX * tileSize;
+			const int y = key.second / tilesX * tileSize;
+			tiles.emplace_back(x, y, std::min(tileSize, width - x), std::min(tileSize, height - y));
+		}
+		tilesWidth = width;
+		tilesHeight = height;
+	}
+
+	uint64_t getTileKey(int tileX, int tileY, int tilesX, int tilesY) const
+	{
+		switch (tileOrder) {
+		case TileOrder::Morton:
+			return mortonIndex(tileX, tileY);
+		case TileOrder::Hilbert: {
+			uint32_t side = 1;
+			while (side < static_cast<uint32_t>(std::max(tilesX, tilesY))) {
+				side *= 2;
+			}
+			return hilbertIndex(tileX, tileY, side);
+		}
+		case TileOrder::Spiral: {
+			//Ring around the center tile first, angle within the ring second
+			const double dx = tileX + 0.5 - tilesX * 0.5;
+			const double dy = tileY + 0.5 - tilesY * 0.5;
+			const uint64_t ring = static_cast<uint64_t>(std::max(std::fabs(dx), std::fabs(dy)));
+			const double angle = std::atan2(dy, dx) + 3.14159265358979323846;
+			return (ring << 32) | static_cast<uint64_t>(angle * 1e8);
+		}
+		case TileOrder::RowMajor:
+		default:
+			return static_cast<uint64_t>(tileY) * tilesX + tileX;
+		}
+	}
+
+	//Interleaves the bits of x and y
+	static uint64_t mortonIndex(uint32_t x, uint32_t y)
+	{
+		uint64_t index = 0;
+		for (int bit = 0; bit < 32; bit++) {
+			index |= (static_cast<uint64_t>((x >> bit) & 1) << (2 * bit)) | (static_cast<uint64_t>((y >> bit) & 1) << (2 * bit + 1));
+		}
+		return index;
+	}
+
+	//Distance along the Hilbert curve filling a side x side square, side a power of two
+	static uint64_t hilbertIndex(uint32_t x, uint32_t y, uint32_t side)
+	{
+		uint64_t index = 0;
+		for (uint32_t half = side / 2; half > 0; half /= 2) {
+			const uint32_t rx = (x & half) > 0 ? 1 : 0;
+			const uint32_t ry = (y & half) > 0 ? 1 : 0;
+			index += static_cast<uint64_t>(half) * half * ((3 * rx) ^ ry);
+			//Rotate the quadrant so the curve inside it connects to its neighbours
+			if (ry == 0) {
+				if (rx == 1) {
+					x = side - 1 - x;
+					y = side - 1 - y;
+				}
+				std::swap(x, y);
+			}
+		}
+		return index;
+	}
+};
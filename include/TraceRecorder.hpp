@@ -0,0 +1,215 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+//Records spans from all threads and writes them in the Chrome trace event format,
+//which chrome://tracing and ui.perfetto.dev can open. Every thread appends to its own
+//buffer without locking; when recording is disabled a span costs one relaxed atomic load.
+class TraceRecorder
+{
+public:
+	typedef std::chrono::high_resolution_clock Clock;
+
+	//Events each thread can hold, further events of that thread are dropped
+	static const size_t EVENTS_PER_THREAD = 1 << 16;
+
+	static TraceRecorder& getInstance()
+	{
+		static TraceRecorder instance;
+		return instance;
+	}
+
+	//Recording threads may be running when tracing is toggled, a new recording starts its timeline at zero
+	void setEnabled(bool enabled)
+	{
+		if (enabled && !recording) {
+			epochTicks.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+		}
+		recording.store(enabled, std::memory_order_release);
+	}
+
+	bool isEnabled() const
+	{
+		return recording.load(std::memory_order_relaxed);
+	}
+
+	//Name shown for the calling thread in the trace viewer. Only kept in a per-thread slot until the thread
+	//records its first event, so naming threads costs nothing while tracing is off.
+	void setThreadName(const std::string& name)
+	{
+		ThreadSlot& slot = getThreadSlot();
+		slot.name = name;
+		if (slot.buffer != nullptr) {
+			std::lock_guard<std::mutex> lock(threadsMutex);
+			slot.buffer->name = name;
+		}
+	}
+
+	//name must be a string literal or otherwise outlive the recorder
+	void recordSpan(const char* name, Clock::time_point start, Clock::time_point end)
+	{
+		if (!isEnabled()) {
+			return;
+		}
+
+		ThreadBuffer* buffer = getThreadBuffer();
+		const size_t count = buffer->count.load(std::memory_order_relaxed);
+		if (count >= EVENTS_PER_THREAD) {
+			buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		const Clock::time_point epoch{ Clock::duration(epochTicks.load(std::memory_order_relaxed)) };
+		Event& event = buffer->events[count];
+		event.name = name;
+		event.start = std::chrono::duration_cast<std::chrono::nanoseconds>(start - epoch).count();
+		event.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		buffer->count.store(count + 1, std::memory_order_release);
+	}
+
+	//Events dropped by all threads because their buffers were full
+	size_t getDroppedEvents()
+	{
+		std::lock_guard<std::mutex> lock(threadsMutex);
+		size_t dropped = 0;
+		for (const std::unique_ptr<ThreadBuffer>& buffer : threads) {
+			dropped += buffer->dropped.load(std::memory_order_relaxed);
+		}
+		return dropped;
+	}
+
+	//Best called once the recording threads are done, events recorded concurrently may or may not be included.
+	//Events dropped per thread are listed under otherData.
+	void writeJSON(std::ostream& out)
+	{
+		std::lock_guard<std::mutex> lock(threadsMutex);
+		out << "{\"traceEvents\": [\n";
+		bool first = true;
+		for (const std::unique_ptr<ThreadBuffer>& buffer : threads) {
+			out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->id
+				<< ", \"args\": {\"name\": \"";
+			writeEscaped(out, (buffer->name.empty() ? "thread " + std::to_string(buffer->id) : buffer->name).c_str());
+			out << "\"}}";
+			first = false;
+
+			const size_t count = buffer->count.load(std::memory_order_acquire);
+			for (size_t i = 0; i < count; i++) {
+				const Event& event = buffer->events[i];
+				//Chrome expects microseconds
+				out << ",\n{\"name\": \"";
+				writeEscaped(out, event.name);
+				out << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->id
+					<< ", \"ts\": " << event.start / 1000.0 << ", \"dur\": " << event.duration / 1000.0 << "}";
+			}
+		}
+		out << "\n], \"otherData\": {\"droppedEvents\": {";
+		first = true;
+		for (const std::unique_ptr<ThreadBuffer>& buffer : threads) {
+			out << (first ? "" : ", ") << "\"" << buffer->id << "\": " << buffer->dropped.load(std::memory_order_relaxed);
+			first = false;
+		}
+		out << "}}}\n";
+	}
+
+private:
+	struct Event {
+		const char* name;
+		int64_t start;
+		int64_t duration;
+	};
+
+	struct ThreadBuffer {
+		int id = 0;
+		std::string name;
+		std::vector<Event> events;
+		std::atomic<size_t> count{ 0 };
+		std::atomic<size_t> dropped{ 0 };
+	};
+
+	struct ThreadSlot {
+		ThreadBuffer* buffer = nullptr;
+		std::string name;
+	};
+
+	std::atomic<bool> recording{ false };
+	//Start of the recording in clock ticks, atomic since threads recording spans read it
+	std::atomic<Clock::rep> epochTicks{ Clock::now().time_since_epoch().count() };
+	std::mutex threadsMutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> threads;
+
+	static ThreadSlot& getThreadSlot()
+	{
+		static thread_local ThreadSlot slot;
+		return slot;
+	}
+
+	//The buffer of a thread is allocated on its first event recorded while enabled and kept until the recorder goes away
+	ThreadBuffer* getThreadBuffer()
+	{
+		ThreadSlot& slot = getThreadSlot();
+		if (slot.buffer == nullptr) {
+			std::unique_ptr<ThreadBuffer> newBuffer(new ThreadBuffer);
+			newBuffer->events.resize(EVENTS_PER_THREAD);
+			newBuffer->name = slot.name;
+			std::lock_guard<std::mutex> lock(threadsMutex);
+			newBuffer->id = static_cast<int>(threads.size()) + 1;
+			slot.buffer = newBuffer.get();
+			threads.push_back(std::move(newBuffer));
+		}
+		return slot.buffer;
+	}
+
+	//Writes text as the contents of a JSON string
+	static void writeEscaped(std::ostream& out, const char* text)
+	{
+		static const char HEX_DIGITS[] = "0123456789abcdef";
+		for (; *text != '\0'; text++) {
+			const char c = *text;
+			const unsigned char code = static_cast<unsigned char>(c);
+			if (c == '"' || c == '\\') {
+				out << '\\' << c;
+			}
+			else if (code < 0x20) {
+				out << "\\u00" << HEX_DIGITS[code >> 4] << HEX_DIGITS[code & 0xf];
+			}
+			else {
+				out << c;
+			}
+		}
+	}
+};
+
+//Records its lifetime as a span of the calling thread if tracing is enabled
+class ScopedTraceSpan
+{
+public:
+	explicit ScopedTraceSpan(const char* name)
+		: name(TraceRecorder::getInstance().isEnabled() ? name : nullptr)
+	{
+		if (this->name != nullptr) {
+			start = TraceRecorder::Clock::now();
+		}
+	}
+
+	~ScopedTraceSpan()
+	{
+		if (name != nullptr) {
+			TraceRecorder::getInstance().recordSpan(name, start, TraceRecorder::Clock::now());
+		}
+	}
+
+	ScopedTraceSpan(const ScopedTraceSpan&) = delete;
+	ScopedTraceSpan& operator=(const ScopedTraceSpan&) = delete;
+
+private:
+	const char* name;
+	TraceRecorder::Clock::time_point start;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+//Lock-free single-producer/single-consumer triple buffer.
+//The producer always owns the back slot and the consumer the front slot; publishing
+//swaps the back slot with the middle one and consuming swaps the front slot with it,
+//so the consumer always picks up the latest published value and neither side waits.
+template <typename T>
+class TripleBuffer
+{
+public:
+	//Slot the producer writes to, only valid on the producer thread
+	T& back()
+	{
+		return slots[backIndex];
+	}
+
+	//Slot last acquired by consume(), only valid on the consumer thread
+	T& front()
+	{
+		return slots[frontIndex];
+	}
+
+	//Direct access to the slots, only safe while neither side is running
+	T& slot(int index)
+	{
+		return slots[index];
+	}
+
+	//Makes the back slot available to the consumer and hands the producer a free one
+	void publish()
+	{
+		const uint8_t previous = middle.exchange(static_cast<uint8_t>(backIndex | NEW_VALUE), std::memory_order_acq_rel);
+		backIndex = previous & INDEX_MASK;
+	}
+
+	//Returns true and moves the latest published slot to the front if anything was published since the last call
+	bool consume()
+	{
+		if ((middle.load(std::memory_order_acquire) & NEW_VALUE) == 0) {
+			return false;
+		}
+		const uint8_t previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+		frontIndex = previous & INDEX_MASK;
+		return true;
+	}
+
+	//Returns true if a published slot is waiting to be consumed
+	bool hasNewValue() const
+	{
+		return (middle.load(std::memory_order_acquire) & NEW_VALUE) != 0;
+	}
+
+private:
+	static const uint8_t INDEX_MASK = 0x3;
+	static const uint8_t NEW_VALUE = 0x4;
+
+	T slots[3];
+	uint8_t backIndex = 0;
+	uint8_t frontIndex = 1;
+	std::atomic<uint8_t> middle{ 2 };
+};
@@ -0,0 +1,329 @@
+#pragma once
+
+#include "AlignedAllocator.hpp"
+#include "Bvh.hpp"
+#include "Geometry.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RAYTRACING_OPENGLVIEWER_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define RAYTRACING_OPENGLVIEWER_AVX2
+#include <immintrin.h>
+#endif
+
+//Node of an 8-wide BVH, 256 bytes on four cache lines. The bounds of the children are stored
+//plane by plane, so one SIMD load fetches the same plane of all eight. Inner children have
+//count == 0 and index a node, leaf children a range of count triangles. Unused slots keep
+//empty bounds, which no ray hits.
+struct alignas(64) WideBvhNode
+{
+	static const int WIDTH = 8;
+
+	//minX, minY, minZ, maxX, maxY, maxZ
+	float bounds[6][WIDTH];
+	uint32_t children[WIDTH];
+	uint32_t counts[WIDTH];
+
+	WideBvhNode()
+	{
+		for (int lane = 0; lane < WIDTH; lane++) {
+			for (int axis = 0; axis < 3; axis++) {
+				bounds[axis][lane] = std::numeric_limits<float>::infinity();
+				bounds[axis + 3][lane] = -std::numeric_limits<float>::infinity();
+			}
+			children[lane] = 0;
+			counts[lane] = 0;
+		}
+	}
+
+	void setChild(int lane, const Aabb& box, uint32_t index, uint32_t count)
+	{
+		for (int axis = 0; axis < 3; axis++) {
+			bounds[axis][lane] = box.min[axis];
+			bounds[axis + 3][lane] = box.max[axis];
+		}
+		children[lane] = index;
+		counts[lane] = count;
+	}
+};
+
+static_assert(sizeof(WideBvhNode) == 256, "WideBvhNode should fill exactly four cache lines");
+
+//Slab test of one ray against the eight children of a WideBvhNode at once
+struct WideRayBoxTest
+{
+	RayBoxTest scalar;
+	//Planes the ray enters and leaves each slab through, chosen once by the sign of the direction
+	int nearPlane[3];
+	int farPlane[3];
+#if defined(RAYTRACING_OPENGLVIEWER_AVX2)
+	__m256 inverseDirection[3];
+	__m256 scaledOrigin[3];
+#elif defined(RAYTRACING_OPENGLVIEWER_SSE2)
+	__m128 inverseDirection[3];
+	__m128 scaledOrigin[3];
+#endif
+
+	explicit WideRayBoxTest(const Ray& ray) : scalar(ray)
+	{
+		for (int axis = 0; axis < 3; axis++) {
+			nearPlane[axis] = axis + 3 * scalar.directionNegative[axis];
+			farPlane[axis] = axis + 3 * (1 - scalar.directionNegative[axis]);
+#if defined(RAYTRACING_OPENGLVIEWER_AVX2)
+			inverseDirection[axis] = _mm256_set1_ps(scalar.inverseDirection[axis]);
+			scaledOrigin[axis] = _mm256_set1_ps(scalar.scaledOrigin[axis]);
+#elif defined(RAYTRACING_OPENGLVIEWER_SSE2)
+			inverseDirection[axis] = _mm_set1_ps(scalar.inverseDirection[axis]);
+			scaledOrigin[axis] = _mm_set1_ps(scalar.scaledOrigin[axis]);
+#endif
+		}
+	}
+
+	//Writes the entry distance of every child to entries and returns a bit per child hit within [tMin, tMax].
+	//Unused slots have min = inf and max = -inf, so their entry lies behind their exit and they are never hit.
+	int intersect(const WideBvhNode& node, float tMin, float tMax, float* entries) const
+	{
+#if defined(RAYTRACING_OPENGLVIEWER_AVX2)
+		__m256 entry = _mm256_set1_ps(tMin);
+		__m256 exit = _mm256_set1_ps(tMax);
+		for (int axis = 0; axis < 3; axis++) {
+			const __m256 nearT = _mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(node.bounds[nearPlane[axis]]), inverseDirection[axis]), scaledOrigin[axis]);
+			const __m256 farT = _mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(node.bounds[farPlane[axis]]), inverseDirection[axis]), scaledOrigin[axis]);
+			entry = _mm256_max_ps(entry, nearT);
+			exit = _mm256_min_ps(exit, farT);
+		}
+		_mm256_storeu_ps(entries, entry);
+		return _mm256_movemask_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ));
+#elif defined(RAYTRACING_OPENGLVIEWER_SSE2)
+		int mask = 0;
+		for (int half = 0; half < WideBvhNode::WIDTH; half += 4) {
+			__m128 entry = _mm_set1_ps(tMin);
+			__m128 exit = _mm_set1_ps(tMax);
+			for (int axis = 0; axis < 3; axis++) {
+				const __m128 nearT = _mm_add_ps(_mm_mul_ps(_mm_load_ps(node.bounds[nearPlane[axis]] + half), inverseDirection[axis]), scaledOrigin[axis]);
+				const __m128 farT = _mm_add_ps(_mm_mul_ps(_mm_load_ps(node.bounds[farPlane[axis]] + half), inverseDirection[axis]), scaledOrigin[axis]);
+				entry = _mm_max_ps(entry, nearT);
+				exit = _mm_min_ps(exit, farT);
+			}
+			_mm_storeu_ps(entries + half, entry);
+			mask |= _mm_movemask_ps(_mm_cmple_ps(entry, exit)) << half;
+		}
+		return mask;
+#else
+		int mask = 0;
+		for (int lane = 0; lane < WideBvhNode::WIDTH; lane++) {
+			float entry = tMin;
+			float exit = tMax;
+			for (int axis = 0; axis < 3; axis++) {
+				entry = std::max(entry, node.bounds[nearPlane[axis]][lane] * scalar.inverseDirection[axis] + scalar.scaledOrigin[axis]);
+				exit = std::min(exit, node.bounds[farPlane[axis]][lane] * scalar.inverseDirection[axis] + scalar.scaledOrigin[axis]);
+			}
+			entries[lane] = entry;
+			mask |= (entry <= exit ? 1 : 0) << lane;
+		}
+		return mask;
+#endif
+	}
+};
+
+//8-wide BVH collapsed from a binary one: every node takes up to eight of the binary nodes below it,
+//opening the child with the largest surface area first. A traversal step tests eight boxes with one
+//SIMD slab test and visits the children hit front to back.
+class WideBvh
+{
+public:
+	static const int WIDTH = WideBvhNode::WIDTH;
+	//The collapsed tree is no deeper than the binary one and every level pushes at most WIDTH - 1 children
+	static const int STACK_SIZE = (WIDTH - 1) * Bvh::MAX_DEPTH;
+
+	//Copies the triangles of bvh, which can be discarded afterwards
+	void build(const Bvh& bvh)
+	{
+		const std::vector<BvhNode>& binaryNodes = bvh.getNodes();
+		if (binaryNodes.empty()) {
+			throw std::runtime_error("Cannot collapse an empty BVH");
+		}
+
+		nodes.clear();
+		nodes.reserve(binaryNodes.size() / (WIDTH - 1) + 1);
+		nodes.emplace_back();
+		bounds = bvh.getBounds();
+		triangles = bvh.getTriangles();
+		if (binaryNodes[0].isLeaf()) {
+			nodes[0].setChild(0, binaryNodes[0].bounds, binaryNodes[0].index, binaryNodes[0].count);
+		}
+		else {
+			collapse(binaryNodes, 0, 0);
+		}
+	}
+
+	//Finds the closest hit within [ray.tMin, ray.tMax], shortening ray.tMax to it
+	bool intersect(Ray& ray, Hit& hit) const
+	{
+		return traverse<false>(ray, hit);
+	}
+
+	//True if anything is hit within [ray.tMin, ray.tMax], e.g. for shadow rays
+	bool occluded(const Ray& ray) const
+	{
+		Ray shortened = ray;
+		Hit hit;
+		return traverse<true>(shortened, hit);
+	}
+
+	//Ordered traversal from node 0 that is shared by the wide node layouts. Node has the children
+	//and counts of a WideBvhNode, boxTest.intersect tests a ray against its WIDTH child boxes.
+	template <bool AnyHit, typename Node, typename BoxTest>
+	static bool traverseNodes(const Node* nodes, const PrecomputedTriangle* triangles, const BoxTest& boxTest, Ray& ray, Hit& hit)
+	{
+		StackEntry stack[STACK_SIZE];
+		int stackSize = 0;
+		StackEntry current = { 0, 0, ray.tMin };
+		bool found = false;
+		while (true) {
+			if (current.count > 0) {
+				for (uint32_t i = current.index; i < current.index + current.count; i++) {
+					if (intersectTriangle(ray, triangles[i], hit)) {
+						found = true;
+						if (AnyHit) {
+							return true;
+						}
+					}
+				}
+			}
+			else {
+				const Node& node = nodes[current.index];
+				alignas(32) float entries[WIDTH];
+				const int mask = boxTest.intersect(node, ray.tMin, ray.tMax, entries);
+				if (mask != 0) {
+					//Children hit, sorted far to near; the nearest is visited next and the others pushed
+					StackEntry hits[WIDTH];
+					int hitCount = 0;
+					for (int lane = 0; lane < WIDTH; lane++) {
+						if (mask & (1 << lane)) {
+							int position = hitCount++;
+							while (position > 0 && hits[position - 1].entry < entries[lane]) {
+								hits[position] = hits[position - 1];
+								position--;
+							}
+							hits[position] = { node.children[lane], node.counts[lane], entries[lane] };
+						}
+					}
+					for (int i = 0; i < hitCount - 1; i++) {
+						stack[stackSize++] = hits[i];
+					}
+					current = hits[hitCount - 1];
+					continue;
+				}
+			}
+
+			do {
+				if (stackSize == 0) {
+					return found;
+				}
+				stackSize--;
+			} while (stack[stackSize].entry > ray.tMax);
+			current = stack[stackSize];
+		}
+	}
+
+	const std::vector<WideBvhNode, AlignedAllocator<WideBvhNode>>& getNodes() const
+	{
+		return nodes;
+	}
+
+	const std::vector<PrecomputedTriangle>& getTriangles() const
+	{
+		return triangles;
+	}
+
+	Aabb getBounds() const
+	{
+		return bounds;
+	}
+
+	size_t getNodeMemorySize() const
+	{
+		return nodes.size() * sizeof(WideBvhNode);
+	}
+
+private:
+	std::vector<WideBvhNode, AlignedAllocator<WideBvhNode>> nodes;
+	std::vector<PrecomputedTriangle> triangles;
+	Aabb bounds;
+
+	//Node or leaf still to visit, with the distance the ray enters it
+	struct StackEntry {
+		uint32_t index;
+		uint32_t count;
+		float entry;
+	};
+
+	void collapse(const std::vector<BvhNode>& binaryNodes, uint32_t binaryIndex, uint32_t wideIndex)
+	{
+		uint32_t children[WIDTH];
+		int childCount = 2;
+		children[0] = binaryNodes[binaryIndex].index;
+		children[1] = binaryNodes[binaryIndex].index + 1;
+		while (childCount < WIDTH) {
+			int largest = -1;
+			float largestArea = -1.0f;
+			for (int i = 0; i < childCount; i++) {
+				const BvhNode& child = binaryNodes[children[i]];
+				const float area = child.bounds.getSurfaceArea();
+				if (!child.isLeaf() && area > largestArea) {
+					largest = i;
+					largestArea = area;
+				}
+			}
+			if (largest < 0) {
+				break;
+			}
+			const uint32_t opened = binaryNodes[children[largest]].index;
+			children[largest] = opened;
+			children[childCount++] = opened + 1;
+		}
+
+		//The inner children of a node are stored next to each other
+		uint32_t wideChildren[WIDTH];
+		for (int i = 0; i < childCount; i++) {
+			const BvhNode& child = binaryNodes[children[i]];
+			if (child.isLeaf()) {
+				nodes[wideIndex].setChild(i, child.bounds, child.index, child.count);
+			}
+			else {
+				wideChildren[i] = static_cast<uint32_t>(nodes.size());
+				nodes.emplace_back();
+				nodes[wideIndex].setChild(i, child.bounds, wideChildren[i], 0);
+			}
+		}
+		for (int i = 0; i < childCount; i++) {
+			if (!binaryNodes[children[i]].isLeaf()) {
+				collapse(binaryNodes, children[i], wideChildren[i]);
+			}
+		}
+	}
+
+	template <bool AnyHit>
+	bool traverse(Ray& ray, Hit& hit) const
+	{
+		if (nodes.empty()) {
+			return false;
+		}
+		const WideRayBoxTest boxTest(ray);
+		if (boxTest.scalar.intersect(bounds, ray.tMin, ray.tMax) == std::numeric_limits<float>::infinity()) {
+			return false;
+		}
+		return traverseNodes<AnyHit>(nodes.data(), triangles.data(), boxTest, ray, hit);
+	}
+};
@@ -1,33 +1,217 @@
 #include "RayTracing_OpenGLViewer.hpp"
+#include "Sampler.hpp"
+#include "TileScheduler.hpp"
+#include "Scene.hpp"
+
+#include <cstdlib>
+#include <memory>
 
 RayTracingOpenGLViewer* RayTracingOpenGLViewer::s_instance = nullptr;
-static thread_local std::mt19937 rng;
-static thread_local std::uniform_real_distribution<double> rando(0.0f, 1.0f);
+//Every pixel draws from a counter-based generator keyed by its index and the frame number,
+//so a frame comes out bit-identical however its pixels are split between threads
+static const uint64_t DEMO_SEED = 0x5eed;
+static std::atomic<uint32_t> demoFrameIndex{ 0 };
 
-//Demonstration of execution from other place
-//This function passes the pixels to display to OpenGL
-std::vector<glm::vec3> createImage() {
-	std::vector<glm::vec3> inputPixels;
-	for (int i = 0; i <= 255; i++) {
-		for (int j = 0; j <= 255; j++) {
-			//inputPixels.emplace_back(glm::vec3((float)i / 255, (float)j / 255, 0));
-			inputPixels.emplace_back(glm::vec3(rando(rng), rando(rng), rando(rng)));
+//Renders the tiles of the demo frames on all cores
+static std::unique_ptr<TileScheduler> tileScheduler;
+
+//Writes the pixels of one tile, called concurrently for different tiles
+void createTile(const FrameView& frame, const ImageRegion& tile, uint32_t sample) {
+	for (int y = tile.y; y < tile.y + tile.height; y++) {
+		glm::vec3* row = frame.row(y);
+		for (int x = tile.x; x < tile.x + tile.width; x++) {
+			//row[x] = glm::vec3((float)x / (frame.width - 1), (float)y / (frame.height - 1), 0);
+			PixelSampler sampler(DEMO_SEED, PixelSampler::pixelIndex(x, y, frame.width), sample);
+			row[x] = glm::vec3(sampler.get(0), sampler.get(1), sampler.get(2));
 		}
 	}
+}
+
+//Demonstration of execution from other place
+//This function writes the pixels to display into the frame lent by the viewer
+void createImage(FrameView& frame) {
+	const uint32_t sample = demoFrameIndex++;
+	tileScheduler->render(frame, [sample](const FrameView& frame, const ImageRegion& tile) {
+		createTile(frame, tile, sample);
+	});
 
 	//std::cout << "Hello world";
-	return inputPixels;
 }
 
-int main() {
-	rng.seed(std::random_device()());
+//Same frames written one plane per channel, selected with --planar
+void createPlanarImage(PlanarFrameView& frame) {
+	const uint32_t sample = demoFrameIndex++;
+	tileScheduler->forEachTile(frame.width, frame.height, [&frame, sample](const ImageRegion& tile) {
+		for (int y = tile.y; y < tile.y + tile.height; y++) {
+			float* red = frame.redRow(y);
+			float* green = frame.greenRow(y);
+			float* blue = frame.blueRow(y);
+			for (int x = tile.x; x < tile.x + tile.width; x++) {
+				PixelSampler sampler(DEMO_SEED, PixelSampler::pixelIndex(x, y, frame.width), sample);
+				red[x] = sampler.get(0);
+				green[x] = sampler.get(1);
+				blue[x] = sampler.get(2);
+			}
+		}
+	});
+}
+
+//Ray traced procedural scene, selected with --raytrace; one jittered sample per pixel and frame
+static std::unique_ptr<RayTracer> rayTracer;
+
+void createRayTracedImage(FrameView& frame) {
+	const uint32_t sample = demoFrameIndex++;
+	tileScheduler->render(frame, [sample](const FrameView& frame, const ImageRegion& tile) {
+		rayTracer->renderTile(frame, tile, sample, DEMO_SEED);
+	});
+}
+
+//Usage: RayTracing_OpenGLViewer_exe [width height] [--hidden | --null] [--frames count] [--output prefix] [--trace file.json] [--threads count]
+//    [--tile-order rowMajor|morton|hilbert|spiral] [--planar]
+//    [--raytrace [detail]] [--bvh binary|wide|compressed] [--traversal single|packet8|packet16]
+//e.g. "RayTracing_OpenGLViewer_exe 3840 2160 --null --frames 100" for a batch run without a display
+int main(int argc, char* argv[]) {
     RayTracingOpenGLViewer* app = RayTracingOpenGLViewer::getInstance();
 	
 	try {
+		std::vector<int> size;
+		std::string outputPrefix;
+		int threadCount = 0;
+		TileOrder tileOrder = TileOrder::RowMajor;
+		bool planar = false;
+		int sceneDetail = 0;
+		BvhLayout bvhLayout = BvhLayout::Wide;
+		bool bvhLayoutGiven = false;
+		RayTraversal rayTraversal = RayTraversal::Single;
+		for (int i = 1; i < argc; i++) {
+			const std::string argument = argv[i];
+			if (argument == "--hidden") {
+				app->setBackend(ViewerBackend::Hidden);
+			}
+			else if (argument == "--null") {
+				app->setBackend(ViewerBackend::Null);
+			}
+			else if (argument == "--frames" && i + 1 < argc) {
+				app->setMaxFrames(std::atoi(argv[++i]));
+			}
+			else if (argument == "--output" && i + 1 < argc) {
+				outputPrefix = argv[++i];
+			}
+			else if (argument == "--trace" && i + 1 < argc) {
+				app->setTraceFile(argv[++i]);
+			}
+			else if (argument == "--raytrace") {
+				sceneDetail = 4;
+				if (i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+					sceneDetail = std::atoi(argv[++i]);
+				}
+			}
+			else if (argument == "--planar") {
+				planar = true;
+			}
+			else if (argument == "--threads" && i + 1 < argc) {
+				threadCount = std::atoi(argv[++i]);
+			}
+			else if (argument == "--tile-order" && i + 1 < argc) {
+				const std::string name = argv[++i];
+				bool known = false;
+				for (TileOrder order : { TileOrder::RowMajor, TileOrder::Morton, TileOrder::Hilbert, TileOrder::Spiral }) {
+					if (name == getTileOrderName(order)) {
+						tileOrder = order;
+						known = true;
+					}
+				}
+				if (!known) {
+					throw std::runtime_error("Unknown tile order " + name);
+				}
+			}
+			else if (argument == "--bvh" && i + 1 < argc) {
+				const std::string name = argv[++i];
+				bool known = false;
+				for (BvhLayout layout : { BvhLayout::Binary, BvhLayout::Wide, BvhLayout::Compressed }) {
+					if (name == getBvhLayoutName(layout)) {
+						bvhLayout = layout;
+						bvhLayoutGiven = true;
+						known = true;
+					}
+				}
+				if (!known) {
+					throw std::runtime_error("Unknown BVH layout " + name);
+				}
+			}
+			else if (argument == "--traversal" && i + 1 < argc) {
+				const std::string name = argv[++i];
+				bool known = false;
+				for (RayTraversal traversal : { RayTraversal::Single, RayTraversal::Packet8, RayTraversal::Packet16 }) {
+					if (name == getRayTraversalName(traversal)) {
+						rayTraversal = traversal;
+						known = true;
+					}
+				}
+				if (!known) {
+					throw std::runtime_error("Unknown ray traversal " + name);
+				}
+			}
+			else {
+				//Anything else has to be one of the two image dimensions, typos and options missing their value end up here
+				char* end = nullptr;
+				const long value = std::strtol(argv[i], &end, 10);
+				if (end == argv[i] || *end != '\0' || value <= 0 || size.size() == 2) {
+					throw std::runtime_error("Unrecognised argument " + argument + "\nUsage: RayTracing_OpenGLViewer_exe [width height] [--hidden | --null] [--frames count] [--output prefix] "
+						"[--trace file.json] [--threads count] [--tile-order rowMajor|morton|hilbert|spiral] [--planar] "
+						"[--raytrace [detail]] [--bvh binary|wide|compressed] [--traversal single|packet8|packet16]");
+				}
+				size.push_back(static_cast<int>(value));
+			}
+		}
+		//Packets only traverse the binary BVH, which they get unless another layout was asked for
+		if (rayTraversal != RayTraversal::Single) {
+			if (bvhLayoutGiven && bvhLayout != BvhLayout::Binary) {
+				throw std::runtime_error(std::string("--traversal ") + getRayTraversalName(rayTraversal) + " needs --bvh binary");
+			}
+			bvhLayout = BvhLayout::Binary;
+		}
+		if (size.size() == 1) {
+			throw std::runtime_error("The image size needs both a width and a height");
+		}
+		if (size.size() == 2) {
+			app->setImageSize(size[0], size[1]);
+		}
+
+		//Writes every displayed frame to prefix_<frame>.pfm
+		int frameNumber = 0;
+		if (!outputPrefix.empty()) {
+			app->setFrameSink([&outputPrefix, &frameNumber](const FrameView& frame) {
+				writePFM(outputPrefix + "_" + std::to_string(frameNumber++) + ".pfm", frame);
+			});
+		}
+
+		tileScheduler.reset(new TileScheduler(threadCount, TileScheduler::DEFAULT_TILE_SIZE, tileOrder));
+
+		if (sceneDetail > 0) {
+			rayTracer.reset(new RayTracer);
+			//Before the scene, so only the structure of this layout is built
+			rayTracer->setBvhLayout(bvhLayout);
+			const auto buildStart = std::chrono::high_resolution_clock::now();
+			rayTracer->setScene(ProceduralScene::createDemoScene(sceneDetail), &tileScheduler->getPool());
+			std::cout << "Built the BVH over " << rayTracer->getMesh().getTriangleCount() << " triangles in "
+				<< std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - buildStart).count() << " ms" << std::endl;
+			rayTracer->setRayTraversal(rayTraversal);
+			rayTracer->setCamera(ProceduralScene::createDemoCamera());
+			//Every frame is one more sample per pixel, the viewer averages them
+			app->setAccumulation(true);
+			app->run(createRayTracedImage);
+			return EXIT_SUCCESS;
+		}
+
+		if (planar) {
+			app->runPlanar(createPlanarImage);
+			return EXIT_SUCCESS;
+		}
+
 		//C++11
-		auto createImageFunctionBind = std::bind(&createImage);
-		std::function<std::vector<glm::vec3>()> createImageFunction = createImageFunctionBind;
-        app->run(createImageFunction);
+		auto createImageFunctionBind = std::bind(&createImage, std::placeholders::_1);
+        app->run(createImageFunctionBind);
     }
     catch (const std::runtime_error& e) {
         std::cerr << e.what() << std::endl;
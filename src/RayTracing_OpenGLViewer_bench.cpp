@@ -0,0 +1,604 @@
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include "GLContext.hpp"
+#include "PixelBufferRing.hpp"
+#include "FrameBuffer.hpp"
+#include "PixelFormats.hpp"
+#include "AlignedAllocator.hpp"
+#include "Sampler.hpp"
+#include "Scene.hpp"
+#include "TaskPool.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Throughput benchmarks for the hot paths of the viewer. Results are written as one JSON object,
+//keyed by suite, so runs can be diffed against each other to catch regressions.
+//Without a display the upload suite falls back to GLFW's null platform with OSMesa where GLFW supports it,
+//otherwise run it under xvfb-run.
+
+struct BenchOptions
+{
+	//Upper bound on the uploaded bytes per measurement, fewer frames are timed for larger images
+	size_t bytesPerMeasurement = size_t(1) << 30;
+	int minFrames = 3;
+	int maxFrames = 200;
+	int maxWidth = 7680;
+	int maxHeight = 4320;
+	//Tessellation of the procedural scene the BVH suites use
+	int sceneDetail = 24;
+	//Image the traversal suite shoots its primary rays through
+	int traversalWidth = 1024;
+	int traversalHeight = 768;
+};
+
+typedef std::chrono::high_resolution_clock BenchClock;
+
+static double secondsSince(BenchClock::time_point start)
+{
+	return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+//How the converted pixels reach the texture
+enum class UploadStrategy {
+	Realloc,	//glTexImage2D from client memory every frame, the storage is reallocated each time
+	SubImage,	//glTexSubImage2D from client memory into storage allocated once
+	PixelBufferRing	//converted straight into a mapped pixel buffer of a fenced ring, the way the viewer uploads
+};
+
+static const char* getUploadStrategyName(UploadStrategy strategy)
+{
+	static const char* names[] = { "realloc", "subImage", "pixelBufferRing" };
+	return names[static_cast<int>(strategy)];
+}
+
+//Hidden window owning the GL context the upload suite runs in, set up like the viewer's hidden backend
+class BenchContext
+{
+public:
+	BenchContext()
+		: window(createContextWindow(64, 64, "RayTracing_OpenGLViewer_bench", true))
+	{
+	}
+
+	~BenchContext()
+	{
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
+
+	BenchContext(const BenchContext&) = delete;
+	BenchContext& operator=(const BenchContext&) = delete;
+
+private:
+	GLFWwindow* window = nullptr;
+};
+
+//Converts every row of the frame into tightly packed rows at destination
+static void convertFrame(UploadFormat format, const FrameBuffer& frame, unsigned char* destination)
+{
+	const size_t rowSize = frame.getWidth() * getPixelFormatInfo(format).pixelSize;
+	for (int y = 0; y < frame.getHeight(); y++) {
+		convertPixels(format, frame.data() + static_cast<size_t>(y) * frame.getStride(), destination + y * rowSize, frame.getWidth());
+	}
+}
+
+//Converts and uploads the frame to a texture the given number of times, returns the elapsed seconds
+static double timeUploads(UploadStrategy strategy, UploadFormat format, const FrameBuffer& frame, int count)
+{
+	const PixelFormatInfo target = getPixelFormatInfo(format);
+	const int width = frame.getWidth();
+	const int height = frame.getHeight();
+	const size_t imageSize = static_cast<size_t>(width) * height * target.pixelSize;
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexImage2D(GL_TEXTURE_2D, 0, target.internalFormat, width, height, 0, target.format, target.type, nullptr);
+
+	AlignedVector<unsigned char> staging;
+	PixelBufferRing pixelBuffers;
+	if (strategy == UploadStrategy::PixelBufferRing) {
+		pixelBuffers.create(3, imageSize);
+	}
+	else {
+		staging.resize(imageSize);
+	}
+	//Keeps the first allocations and the driver warm-up out of the measurement
+	glFinish();
+
+	const BenchClock::time_point start = BenchClock::now();
+	for (int i = 0; i < count; i++) {
+		switch (strategy) {
+		case UploadStrategy::Realloc:
+			convertFrame(format, frame, staging.data());
+			glTexImage2D(GL_TEXTURE_2D, 0, target.internalFormat, width, height, 0, target.format, target.type, staging.data());
+			break;
+
+		case UploadStrategy::SubImage:
+			convertFrame(format, frame, staging.data());
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, target.format, target.type, staging.data());
+			break;
+
+		case UploadStrategy::PixelBufferRing: {
+			void* mapped = pixelBuffers.map(imageSize);
+			if (mapped == nullptr) {
+				pixelBuffers.unbind();
+				throw std::runtime_error("Failed to map a pixel buffer");
+			}
+			convertFrame(format, frame, static_cast<unsigned char*>(mapped));
+			if (pixelBuffers.unmap()) {
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, target.format, target.type, nullptr);
+			}
+			pixelBuffers.fence();
+			pixelBuffers.unbind();
+			break;
+		}
+		}
+	}
+	//The uploads only count once the GL is done with them
+	glFinish();
+	const double seconds = secondsSince(start);
+
+	pixelBuffers.destroy();
+	glDeleteTextures(1, &texture);
+	return seconds;
+}
+
+static void benchmarkUploads(std::ostream& out, const BenchOptions& options)
+{
+	BenchContext context;
+
+	GLint maxTextureSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+	std::cerr << "Upload benchmark on " << glGetString(GL_RENDERER) << std::endl;
+
+	const int sizes[][2] = { { 256, 256 }, { 512, 512 }, { 1024, 1024 }, { 1920, 1080 }, { 3840, 2160 }, { 7680, 4320 } };
+	const UploadFormat formats[] = { UploadFormat::RGB32F, UploadFormat::RGBA16F, UploadFormat::RGB10_A2, UploadFormat::SRGB8_A8, UploadFormat::RGB9_E5 };
+	const UploadStrategy strategies[] = { UploadStrategy::Realloc, UploadStrategy::SubImage, UploadStrategy::PixelBufferRing };
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> rando(0.0f, 1.0f);
+
+	out << "{\"renderer\": \"" << glGetString(GL_RENDERER) << "\", \"results\": [";
+	bool first = true;
+	for (const auto& size : sizes) {
+		const int width = size[0];
+		const int height = size[1];
+		if (width > options.maxWidth || height > options.maxHeight || width > maxTextureSize || height > maxTextureSize) {
+			continue;
+		}
+
+		FrameBuffer frame;
+		frame.resize(width, height);
+		FrameView view = frame.view();
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				view.at(x, y) = glm::vec3(rando(rng), rando(rng), rando(rng));
+			}
+		}
+
+		for (UploadFormat format : formats) {
+			const size_t imageSize = static_cast<size_t>(width) * height * getPixelFormatInfo(format).pixelSize;
+			int count = static_cast<int>(options.bytesPerMeasurement / imageSize);
+			count = std::max(options.minFrames, std::min(options.maxFrames, count));
+
+			for (UploadStrategy strategy : strategies) {
+				//One untimed frame so first-use costs in the driver do not skew small sizes
+				timeUploads(strategy, format, frame, 1);
+				const double seconds = timeUploads(strategy, format, frame, count);
+
+				const double framesPerSecond = count / seconds;
+				const double megabytesPerSecond = imageSize * framesPerSecond / (1024.0 * 1024.0);
+				out << (first ? "\n" : ",\n") << "  {\"strategy\": \"" << getUploadStrategyName(strategy)
+					<< "\", \"format\": \"" << getPixelFormatInfo(format).name
+					<< "\", \"width\": " << width << ", \"height\": " << height << ", \"frames\": " << count
+					<< ", \"msPerFrame\": " << seconds * 1000.0 / count
+					<< ", \"framesPerSecond\": " << framesPerSecond << ", \"megabytesPerSecond\": " << megabytesPerSecond << "}";
+				first = false;
+
+				std::cerr << width << "x" << height << " " << getPixelFormatInfo(format).name << " " << getUploadStrategyName(strategy)
+					<< ": " << framesPerSecond << " frames/s, " << megabytesPerSecond << " MB/s" << std::endl;
+			}
+		}
+	}
+	out << "\n]}";
+}
+
+//Times one way of drawing count uniform floats, returns samples per second.
+//The sum keeps the compiler from dropping the draws.
+template <typename Draw>
+static double timeSamples(size_t count, Draw draw)
+{
+	const BenchClock::time_point start = BenchClock::now();
+	const float sum = draw(count);
+	const double seconds = secondsSince(start);
+	volatile float sink = sum;
+	(void)sink;
+	return count / seconds;
+}
+
+//Compares the generator the demo producer used to have with the vectorized sampler and the counter-based one
+static void benchmarkSamplers(std::ostream& out)
+{
+	const size_t count = size_t(1) << 26;
+	//Large enough to behave like a row of pixels, small enough to stay in the L1 cache
+	const size_t batch = 3 * 1024;
+	std::vector<float> values(batch);
+
+	std::vector<std::pair<const char*, double>> results;
+	results.emplace_back("mt19937Double", timeSamples(count, [](size_t n) {
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<double> rando(0.0, 1.0);
+		float sum = 0.0f;
+		for (size_t i = 0; i < n; i++) {
+			sum += static_cast<float>(rando(rng));
+		}
+		return sum;
+	}));
+	results.emplace_back("mt19937Float", timeSamples(count, [](size_t n) {
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> rando(0.0f, 1.0f);
+		float sum = 0.0f;
+		for (size_t i = 0; i < n; i++) {
+			sum += rando(rng);
+		}
+		return sum;
+	}));
+	results.emplace_back("samplerNext", timeSamples(count, [](size_t n) {
+		Sampler sampler(1234);
+		float sum = 0.0f;
+		for (size_t i = 0; i < n; i++) {
+			sum += sampler.next();
+		}
+		return sum;
+	}));
+	results.emplace_back("samplerFill", timeSamples(count, [&values, batch](size_t n) {
+		Sampler sampler(1234);
+		float sum = 0.0f;
+		for (size_t i = 0; i < n; i += batch) {
+			const size_t filled = std::min(batch, n - i);
+			sampler.fill(values.data(), filled);
+			for (size_t j = 0; j < filled; j++) {
+				sum += values[j];
+			}
+		}
+		return sum;
+	}));
+
+	results.emplace_back("philoxPixel", timeSamples(count, [](size_t n) {
+		float sum = 0.0f;
+		for (size_t i = 0; i < n; i += 4) {
+			PixelSampler sampler(1234, static_cast<uint32_t>(i >> 2), 0);
+			sum += sampler.get(0) + sampler.get(1) + sampler.get(2) + sampler.get(3);
+		}
+		return sum;
+	}));
+
+	out << "{\"samples\": " << count << ", \"samplesPerSecond\": {";
+	for (size_t i = 0; i < results.size(); i++) {
+		out << (i == 0 ? "" : ", ") << "\"" << results[i].first << "\": " << results[i].second;
+		std::cerr << results[i].first << ": " << results[i].second / 1e6 << " M samples/s" << std::endl;
+	}
+	out << "}}";
+}
+
+//BVH build time over the procedural scene as the number of threads grows
+static void benchmarkBvhBuild(std::ostream& out, const BenchOptions& options)
+{
+	const TriangleMesh mesh = ProceduralScene::createDemoScene(options.sceneDetail);
+	const size_t triangleCount = mesh.getTriangleCount();
+
+	std::vector<int> threadCounts;
+	const int hardwareThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	for (int threads = 1; threads < hardwareThreads; threads *= 2) {
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(hardwareThreads);
+
+	out << "{\"triangles\": " << triangleCount << ", \"results\": [";
+	for (size_t i = 0; i < threadCounts.size(); i++) {
+		TaskPool pool(threadCounts[i]);
+		//Best of a few builds, the first one also pays for page faults
+		double seconds = 0.0;
+		for (int run = 0; run < 3; run++) {
+			Bvh bvh;
+			const BenchClock::time_point start = BenchClock::now();
+			bvh.build(mesh, threadCounts[i] > 1 ? &pool : nullptr);
+			const double runSeconds = secondsSince(start);
+			seconds = run == 0 ? runSeconds : std::min(seconds, runSeconds);
+		}
+
+		const double trianglesPerSecond = triangleCount / seconds;
+		out << (i == 0 ? "\n" : ",\n") << "  {\"threads\": " << threadCounts[i] << ", \"buildMs\": " << seconds * 1000.0
+			<< ", \"trianglesPerSecond\": " << trianglesPerSecond << "}";
+		std::cerr << "BVH build over " << triangleCount << " triangles on " << threadCounts[i] << " threads: "
+			<< seconds * 1000.0 << " ms, " << trianglesPerSecond / 1e6 << " M triangles/s" << std::endl;
+	}
+	out << "\n]}";
+}
+
+//Primary rays through every pixel of a traversalWidth x traversalHeight image of the demo camera
+static std::vector<Ray> createPrimaryRays(const BenchOptions& options)
+{
+	const Camera camera = ProceduralScene::createDemoCamera();
+	const float aspectRatio = static_cast<float>(options.traversalWidth) / options.traversalHeight;
+	std::vector<Ray> rays;
+	rays.reserve(static_cast<size_t>(options.traversalWidth) * options.traversalHeight);
+	for (int y = 0; y < options.traversalHeight; y++) {
+		for (int x = 0; x < options.traversalWidth; x++) {
+			rays.push_back(camera.generateRay((x + 0.5f) / options.traversalWidth, (y + 0.5f) / options.traversalHeight, aspectRatio));
+		}
+	}
+	return rays;
+}
+
+//Closest-hit rays per second over all rays, best of a few passes; hits is the sum of hit distances as a checksum
+template <typename Accelerator>
+static double timeClosestHits(const Accelerator& accelerator, const std::vector<Ray>& rays, double& hits)
+{
+	double seconds = 0.0;
+	for (int run = 0; run < 3; run++) {
+		hits = 0.0;
+		const BenchClock::time_point start = BenchClock::now();
+		for (const Ray& primary : rays) {
+			Ray ray = primary;
+			Hit hit;
+			if (accelerator.intersect(ray, hit)) {
+				hits += hit.t;
+			}
+		}
+		const double runSeconds = secondsSince(start);
+		seconds = run == 0 ? runSeconds : std::min(seconds, runSeconds);
+	}
+	return rays.size() / seconds;
+}
+
+template <typename Accelerator>
+static double timeOcclusion(const Accelerator& accelerator, const std::vector<Ray>& rays, size_t& occluded)
+{
+	double seconds = 0.0;
+	for (int run = 0; run < 3; run++) {
+		occluded = 0;
+		const BenchClock::time_point start = BenchClock::now();
+		for (const Ray& ray : rays) {
+			occluded += accelerator.occluded(ray) ? 1 : 0;
+		}
+		const double runSeconds = secondsSince(start);
+		seconds = run == 0 ? runSeconds : std::min(seconds, runSeconds);
+	}
+	return rays.size() / seconds;
+}
+
+//Rays per second traced in packets over the 4 x (Size / 4) pixel blocks of the image, pixels whose used
+//flag is 0 are left out. Closest hits sum their distances into hits, shadow rays count into occluded.
+template <int Size>
+static double timePackets(const Bvh& bvh, const BenchOptions& options, const std::vector<Ray>& rays, const std::vector<char>& used,
+	bool shadowRays, double& hits, size_t& occluded)
+{
+	const int blockWidth = 4;
+	const int blockHeight = Size / blockWidth;
+	double seconds = 0.0;
+	size_t rayCount = 0;
+	for (int run = 0; run < 3; run++) {
+		hits = 0.0;
+		occluded = 0;
+		rayCount = 0;
+		const BenchClock::time_point start = BenchClock::now();
+		for (int blockY = 0; blockY < options.traversalHeight; blockY += blockHeight) {
+			for (int blockX = 0; blockX < options.traversalWidth; blockX += blockWidth) {
+				RayPacket<Size> packet;
+				for (int lane = 0; lane < Size; lane++) {
+					const int x = blockX + lane % blockWidth;
+					const int y = blockY + lane / blockWidth;
+					const size_t pixel = static_cast<size_t>(y) * options.traversalWidth + x;
+					if (x < options.traversalWidth && y < options.traversalHeight && used[pixel]) {
+						packet.setRay(lane, rays[pixel]);
+						rayCount++;
+					}
+				}
+				if (shadowRays) {
+					occluded += std::bitset<32>(occludedPacket(bvh, packet)).count();
+					continue;
+				}
+				const uint32_t hitMask = intersectPacket(bvh, packet);
+				for (int lane = 0; lane < Size; lane++) {
+					if (hitMask & (1u << lane)) {
+						hits += packet.hits[lane].t;
+					}
+				}
+			}
+		}
+		const double runSeconds = secondsSince(start);
+		seconds = run == 0 ? runSeconds : std::min(seconds, runSeconds);
+	}
+	return rayCount / seconds;
+}
+
+//Single-threaded closest-hit and shadow ray throughput and node memory of every BVH layout over the same rays,
+//and of packets through the binary BVH
+static void benchmarkBvhTraversal(std::ostream& out, const BenchOptions& options)
+{
+	const TriangleMesh mesh = ProceduralScene::createDemoScene(options.sceneDetail);
+	Bvh bvh;
+	bvh.build(mesh);
+	WideBvh wideBvh;
+	wideBvh.build(bvh);
+	CompressedWideBvh compressedBvh;
+	compressedBvh.build(wideBvh);
+
+	//Shadow rays towards the light of the RayTracer from every primary hit, also kept per pixel for the packets
+	const std::vector<Ray> primaryRays = createPrimaryRays(options);
+	const glm::vec3 lightDirection = glm::normalize(glm::vec3(0.5f, 1.0f, 0.3f));
+	std::vector<Ray> shadowRays;
+	std::vector<Ray> pixelShadowRays(primaryRays.size());
+	std::vector<char> hasShadowRay(primaryRays.size(), 0);
+	for (size_t i = 0; i < primaryRays.size(); i++) {
+		Ray ray = primaryRays[i];
+		Hit hit;
+		if (bvh.intersect(ray, hit)) {
+			pixelShadowRays[i] = Ray(ray.origin + ray.direction * hit.t + mesh.getNormal(hit.triangle) * 1e-3f, lightDirection);
+			hasShadowRay[i] = 1;
+			shadowRays.push_back(pixelShadowRays[i]);
+		}
+	}
+	const std::vector<char> hasPrimaryRay(primaryRays.size(), 1);
+
+	out << "{\"triangles\": " << mesh.getTriangleCount() << ", \"primaryRays\": " << primaryRays.size()
+		<< ", \"shadowRays\": " << shadowRays.size() << ", \"results\": [";
+	for (BvhLayout layout : { BvhLayout::Binary, BvhLayout::Wide, BvhLayout::Compressed }) {
+		double hits = 0.0;
+		size_t occluded = 0;
+		double primaryPerSecond = 0.0;
+		double shadowPerSecond = 0.0;
+		size_t nodeBytes = 0;
+		if (layout == BvhLayout::Binary) {
+			primaryPerSecond = timeClosestHits(bvh, primaryRays, hits);
+			shadowPerSecond = timeOcclusion(bvh, shadowRays, occluded);
+			nodeBytes = bvh.getNodeMemorySize();
+		}
+		else if (layout == BvhLayout::Wide) {
+			primaryPerSecond = timeClosestHits(wideBvh, primaryRays, hits);
+			shadowPerSecond = timeOcclusion(wideBvh, shadowRays, occluded);
+			nodeBytes = wideBvh.getNodeMemorySize();
+		}
+		else {
+			primaryPerSecond = timeClosestHits(compressedBvh, primaryRays, hits);
+			shadowPerSecond = timeOcclusion(compressedBvh, shadowRays, occluded);
+			nodeBytes = compressedBvh.getNodeMemorySize();
+		}
+		const double nodeBytesPerTriangle = static_cast<double>(nodeBytes) / mesh.getTriangleCount();
+
+		out << (layout == BvhLayout::Binary ? "\n" : ",\n") << "  {\"layout\": \"" << getBvhLayoutName(layout) << "\", \"traversal\": \"single\", \"nodeBytes\": " << nodeBytes
+			<< ", \"nodeBytesPerTriangle\": " << nodeBytesPerTriangle
+			<< ", \"primaryRaysPerSecond\": " << primaryPerSecond << ", \"shadowRaysPerSecond\": " << shadowPerSecond
+			<< ", \"hitDistanceSum\": " << hits << ", \"occluded\": " << occluded << "}";
+		std::cerr << getBvhLayoutName(layout) << " BVH, " << nodeBytes / 1024 << " KB of nodes (" << nodeBytesPerTriangle << " per triangle): " << primaryPerSecond / 1e6 << " M primary rays/s, "
+			<< shadowPerSecond / 1e6 << " M shadow rays/s" << std::endl;
+	}
+
+	for (RayTraversal traversal : { RayTraversal::Packet8, RayTraversal::Packet16 }) {
+		double hits = 0.0;
+		size_t occluded = 0;
+		size_t unused = 0;
+		double unusedHits = 0.0;
+		double primaryPerSecond = 0.0;
+		double shadowPerSecond = 0.0;
+		if (traversal == RayTraversal::Packet8) {
+			primaryPerSecond = timePackets<8>(bvh, options, primaryRays, hasPrimaryRay, false, hits, unused);
+			shadowPerSecond = timePackets<8>(bvh, options, pixelShadowRays, hasShadowRay, true, unusedHits, occluded);
+		}
+		else {
+			primaryPerSecond = timePackets<16>(bvh, options, primaryRays, hasPrimaryRay, false, hits, unused);
+			shadowPerSecond = timePackets<16>(bvh, options, pixelShadowRays, hasShadowRay, true, unusedHits, occluded);
+		}
+
+		out << ",\n  {\"layout\": \"binary\", \"traversal\": \"" << getRayTraversalName(traversal) << "\", \"nodeBytes\": " << bvh.getNodeMemorySize()
+			<< ", \"nodeBytesPerTriangle\": " << static_cast<double>(bvh.getNodeMemorySize()) / mesh.getTriangleCount()
+			<< ", \"primaryRaysPerSecond\": " << primaryPerSecond << ", \"shadowRaysPerSecond\": " << shadowPerSecond
+			<< ", \"hitDistanceSum\": " << hits << ", \"occluded\": " << occluded << "}";
+		std::cerr << "binary BVH, " << getRayTraversalName(traversal) << ": " << primaryPerSecond / 1e6 << " M primary rays/s, "
+			<< shadowPerSecond / 1e6 << " M shadow rays/s" << std::endl;
+	}
+	out << "\n]}";
+}
+
+//Usage: RayTracing_OpenGLViewer_bench [sampler] [bvhBuild] [bvhTraversal] [upload] [--max-size width height] [--frames min max]
+//    [--detail sceneDetail] [--rays width height] [--output file.json]
+//Runs every suite if none is named. The JSON goes to stdout unless an output file is given, progress goes to stderr.
+int main(int argc, char* argv[]) {
+	const char* knownSuites[] = { "sampler", "bvhBuild", "bvhTraversal", "upload" };
+	BenchOptions options;
+	std::vector<std::string> suites;
+	std::string outputFile;
+	for (int i = 1; i < argc; i++) {
+		const std::string argument = argv[i];
+		if (argument == "--max-size" && i + 2 < argc) {
+			options.maxWidth = std::atoi(argv[++i]);
+			options.maxHeight = std::atoi(argv[++i]);
+		}
+		else if (argument == "--frames" && i + 2 < argc) {
+			options.minFrames = std::max(1, std::atoi(argv[++i]));
+			options.maxFrames = std::max(options.minFrames, std::atoi(argv[++i]));
+		}
+		else if (argument == "--rays" && i + 2 < argc) {
+			options.traversalWidth = std::max(1, std::atoi(argv[++i]));
+			options.traversalHeight = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (argument == "--detail" && i + 1 < argc) {
+			options.sceneDetail = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (argument == "--output" && i + 1 < argc) {
+			outputFile = argv[++i];
+		}
+		else if (std::find(std::begin(knownSuites), std::end(knownSuites), argument) != std::end(knownSuites)) {
+			suites.push_back(argument);
+		}
+		else {
+			std::cerr << "Unknown argument " << argument << ", the suites are sampler, bvhBuild, bvhTraversal and upload" << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::ostringstream results;
+	bool firstSuite = true;
+	//Starts the JSON entry of the suite if it was asked for
+	const auto selected = [&suites, &results, &firstSuite](const char* suite) {
+		if (!suites.empty() && std::find(suites.begin(), suites.end(), suite) == suites.end()) {
+			return false;
+		}
+		results << (firstSuite ? "" : ",\n") << "\"" << suite << "\": ";
+		firstSuite = false;
+		return true;
+	};
+
+	try {
+		results << "{";
+		if (selected("sampler")) {
+			benchmarkSamplers(results);
+		}
+		if (selected("bvhBuild")) {
+			benchmarkBvhBuild(results, options);
+		}
+		if (selected("bvhTraversal")) {
+			benchmarkBvhTraversal(results, options);
+		}
+		if (selected("upload")) {
+			benchmarkUploads(results, options);
+		}
+		results << "}\n";
+	}
+	catch (const std::runtime_error& e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (outputFile.empty()) {
+		std::cout << results.str();
+	}
+	else {
+		std::ofstream file(outputFile);
+		file << results.str();
+		if (!file) {
+			std::cerr << "Failed to write " << outputFile << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}